@@ -0,0 +1,428 @@
+#include "filesys/bufcache-policy.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+#include "threads/malloc.h"
+
+/* Buffer cache replacement policies: strict LRU, CLOCK (second chance),
+   2Q and ARC.  Only one policy is active at a time, so each keeps its
+   state in file-scope variables. */
+
+/* A queue of policy elements that knows its length. */
+struct queue {
+    struct list list;
+    size_t size;
+};
+
+static void queue_init(struct queue* q)
+{
+    list_init(&q->list);
+    q->size = 0;
+}
+
+static void queue_push_front(struct queue* q, struct list_elem* e)
+{
+    list_push_front(&q->list, e);
+    q->size++;
+}
+
+static void queue_remove(struct queue* q, struct list_elem* e)
+{
+    list_remove(e);
+    q->size--;
+}
+
+/* Proposes the elements of Q to CLAIM, least recently used first.
+   Returns the element taken, which is removed from Q.  Sets *STOP
+   if CLAIM asked to stop looking. */
+static struct policy_elem* scan_queue(struct queue* q, policy_claim_func* claim, void* aux, bool* stop)
+{
+    for (struct list_elem* e = list_rbegin(&q->list); e != list_rend(&q->list); e = list_prev(e)) {
+        struct policy_elem* pe = list_entry(e, struct policy_elem, elem);
+        enum policy_verdict verdict = claim(pe, aux);
+        if (verdict == POLICY_TAKE) {
+            queue_remove(q, e);
+            return pe;
+        }
+        if (verdict == POLICY_STOP) {
+            *stop = true;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Ghosts: sectors evicted recently, remembered by 2Q and ARC to
+   recognize blocks that are re-referenced soon after eviction. */
+struct ghost {
+    block_sector_t sector;
+    int queue;                  /* Ghost queue this ghost is on. */
+    struct list_elem elem;
+    struct hash_elem hash_elem; /* Element in ghost_index. */
+};
+
+static struct hash ghost_index;
+static bool ghost_index_ready;
+
+static unsigned ghost_hash(const struct hash_elem* e, void* aux UNUSED)
+{
+    return hash_int(hash_entry(e, struct ghost, hash_elem)->sector);
+}
+
+static bool ghost_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED)
+{
+    return hash_entry(a, struct ghost, hash_elem)->sector
+           < hash_entry(b, struct ghost, hash_elem)->sector;
+}
+
+static void ghost_init(void)
+{
+    if (!ghost_index_ready && !hash_init(&ghost_index, ghost_hash, ghost_less, NULL))
+        PANIC("bufcache ghost index creation failed");
+    ghost_index_ready = true;
+}
+
+/* Returns the ghost of SECTOR, or a null pointer. */
+static struct ghost* ghost_find(block_sector_t sector)
+{
+    struct ghost key;
+    key.sector = sector;
+    struct hash_elem* e = hash_find(&ghost_index, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct ghost, hash_elem) : NULL;
+}
+
+/* Remembers SECTOR at the front of ghost queue Q, whose id is QUEUE.
+   Ghosts are only hints, so running out of memory just forgets it. */
+static void ghost_add(struct queue* q, int queue, block_sector_t sector)
+{
+    struct ghost* g = malloc(sizeof *g);
+    if (g == NULL)
+        return;
+    g->sector = sector;
+    g->queue = queue;
+    queue_push_front(q, &g->elem);
+    hash_insert(&ghost_index, &g->hash_elem);
+}
+
+/* Forgets G, which is on ghost queue Q. */
+static void ghost_forget(struct queue* q, struct ghost* g)
+{
+    queue_remove(q, &g->elem);
+    hash_delete(&ghost_index, &g->hash_elem);
+    free(g);
+}
+
+/* Forgets the oldest ghost of Q. */
+static void ghost_forget_oldest(struct queue* q)
+{
+    ASSERT(q->size > 0);
+    ghost_forget(q, list_entry(list_back(&q->list), struct ghost, elem));
+}
+
+/* Resize hook of the policies that do not depend on the cache size. */
+static void no_resize(size_t capacity UNUSED)
+{
+}
+
+/* Strict LRU: a hit moves the entry to the front, the victim is the
+   entry farthest back. */
+static struct queue lru_queue;
+
+static void lru_init(void)
+{
+    queue_init(&lru_queue);
+}
+
+static void lru_insert(struct policy_elem* pe, block_sector_t sector)
+{
+    pe->sector = sector;
+    queue_push_front(&lru_queue, &pe->elem);
+}
+
+static void lru_touch(struct policy_elem* pe)
+{
+    list_remove(&pe->elem);
+    list_push_front(&lru_queue.list, &pe->elem);
+}
+
+static void lru_remove(struct policy_elem* pe)
+{
+    queue_remove(&lru_queue, &pe->elem);
+}
+
+static struct policy_elem* lru_evict(block_sector_t incoming UNUSED, policy_claim_func* claim, void* aux)
+{
+    bool stop = false;
+    return scan_queue(&lru_queue, claim, aux, &stop);
+}
+
+/* CLOCK: entries sit on a ring swept by a hand.  A hit only sets the
+   entry's reference bit; the hand clears set bits and evicts the first
+   entry whose bit is already clear. */
+static struct queue clock_ring;
+static struct list_elem* clock_hand;
+
+static void clock_init(void)
+{
+    queue_init(&clock_ring);
+    clock_hand = NULL;
+}
+
+/* Moves the hand to the next entry on the ring. */
+static void clock_advance(void)
+{
+    clock_hand = list_next(clock_hand);
+    if (clock_hand == list_end(&clock_ring.list))
+        clock_hand = list_begin(&clock_ring.list);
+}
+
+static void clock_insert(struct policy_elem* pe, block_sector_t sector)
+{
+    pe->sector = sector;
+    pe->referenced = true;
+    if (clock_hand == NULL) {
+        list_push_back(&clock_ring.list, &pe->elem);
+        clock_ring.size++;
+        clock_hand = &pe->elem;
+    } else {
+        /* Just behind the hand, so that it is looked at last. */
+        list_insert(clock_hand, &pe->elem);
+        clock_ring.size++;
+    }
+}
+
+static void clock_touch(struct policy_elem* pe)
+{
+    pe->referenced = true;
+}
+
+static void clock_remove(struct policy_elem* pe)
+{
+    if (clock_hand == &pe->elem)
+        clock_advance();
+    queue_remove(&clock_ring, &pe->elem);
+    if (clock_ring.size == 0)
+        clock_hand = NULL;
+}
+
+static struct policy_elem* clock_evict(block_sector_t incoming UNUSED, policy_claim_func* claim, void* aux)
+{
+    /* Two sweeps clear every reference bit, so a third finds any
+       entry that is not busy. */
+    for (size_t steps = 0; clock_hand != NULL && steps < 3 * clock_ring.size; steps++) {
+        struct policy_elem* pe = list_entry(clock_hand, struct policy_elem, elem);
+        if (pe->referenced) {
+            pe->referenced = false;
+            clock_advance();
+            continue;
+        }
+        enum policy_verdict verdict = claim(pe, aux);
+        if (verdict == POLICY_TAKE) {
+            clock_remove(pe);
+            return pe;
+        }
+        if (verdict == POLICY_STOP)
+            return NULL;
+        clock_advance();
+    }
+    return NULL;
+}
+
+/* 2Q (Johnson and Shasha): new blocks enter the FIFO A1in.  Blocks
+   evicted from A1in are remembered in the ghost queue A1out, and only
+   blocks referenced again while in A1out are promoted to the LRU
+   queue Am.  A long scan therefore only churns A1in. */
+enum { TWOQ_A1IN, TWOQ_AM, TWOQ_A1OUT };
+
+static struct queue twoq_a1in, twoq_am, twoq_a1out;
+static size_t twoq_kin;     /* Target size of A1in. */
+static size_t twoq_kout;    /* Maximum size of A1out. */
+
+static void twoq_init(void)
+{
+    ghost_init();
+    queue_init(&twoq_a1in);
+    queue_init(&twoq_am);
+    queue_init(&twoq_a1out);
+    twoq_kin = twoq_kout = 1;
+}
+
+static void twoq_resize(size_t capacity)
+{
+    twoq_kin = capacity / 4 > 0 ? capacity / 4 : 1;
+    twoq_kout = capacity / 2 > 0 ? capacity / 2 : 1;
+    while (twoq_a1out.size > twoq_kout)
+        ghost_forget_oldest(&twoq_a1out);
+}
+
+static void twoq_insert(struct policy_elem* pe, block_sector_t sector)
+{
+    struct ghost* g = ghost_find(sector);
+    pe->sector = sector;
+    if (g != NULL && g->queue == TWOQ_A1OUT) {
+        ghost_forget(&twoq_a1out, g);
+        pe->queue = TWOQ_AM;
+        queue_push_front(&twoq_am, &pe->elem);
+    } else {
+        pe->queue = TWOQ_A1IN;
+        queue_push_front(&twoq_a1in, &pe->elem);
+    }
+}
+
+static void twoq_touch(struct policy_elem* pe)
+{
+    /* Hits in A1in are correlated references and do not promote. */
+    if (pe->queue == TWOQ_AM) {
+        list_remove(&pe->elem);
+        list_push_front(&twoq_am.list, &pe->elem);
+    }
+}
+
+static void twoq_remove(struct policy_elem* pe)
+{
+    queue_remove(pe->queue == TWOQ_AM ? &twoq_am : &twoq_a1in, &pe->elem);
+}
+
+/* Evicts from A1in, remembering the victim in A1out. */
+static struct policy_elem* twoq_evict_a1in(policy_claim_func* claim, void* aux, bool* stop)
+{
+    struct policy_elem* pe = scan_queue(&twoq_a1in, claim, aux, stop);
+    if (pe != NULL) {
+        if (twoq_a1out.size >= twoq_kout)
+            ghost_forget_oldest(&twoq_a1out);
+        ghost_add(&twoq_a1out, TWOQ_A1OUT, pe->sector);
+    }
+    return pe;
+}
+
+static struct policy_elem* twoq_evict(block_sector_t incoming UNUSED, policy_claim_func* claim, void* aux)
+{
+    bool stop = false;
+    struct policy_elem* pe = NULL;
+    if (twoq_a1in.size > twoq_kin)
+        pe = twoq_evict_a1in(claim, aux, &stop);
+    if (pe == NULL && !stop)
+        pe = scan_queue(&twoq_am, claim, aux, &stop);
+    if (pe == NULL && !stop)
+        pe = twoq_evict_a1in(claim, aux, &stop);
+    return pe;
+}
+
+/* ARC (Megiddo and Modha): T1 holds blocks seen once recently, T2
+   blocks seen at least twice.  Ghost queues B1 and B2 remember blocks
+   evicted from each, and hits on them shift the target size P of T1
+   towards whichever side would have kept the block. */
+enum { ARC_T1, ARC_T2, ARC_B1, ARC_B2 };
+
+static struct queue arc_t1, arc_t2, arc_b1, arc_b2;
+static size_t arc_c;        /* Cache capacity. */
+static size_t arc_p;        /* Target size of T1. */
+
+static void arc_init(void)
+{
+    ghost_init();
+    queue_init(&arc_t1);
+    queue_init(&arc_t2);
+    queue_init(&arc_b1);
+    queue_init(&arc_b2);
+    arc_c = 0;
+    arc_p = 0;
+}
+
+/* Keeps |T1| + |B1| <= c and the whole directory within 2c. */
+static void arc_trim_ghosts(void)
+{
+    while (arc_t1.size + arc_b1.size > arc_c && arc_b1.size > 0)
+        ghost_forget_oldest(&arc_b1);
+    while (arc_t1.size + arc_t2.size + arc_b1.size + arc_b2.size > 2 * arc_c && arc_b2.size > 0)
+        ghost_forget_oldest(&arc_b2);
+}
+
+static void arc_resize(size_t capacity)
+{
+    arc_c = capacity;
+    if (arc_p > arc_c)
+        arc_p = arc_c;
+    arc_trim_ghosts();
+}
+
+static void arc_insert(struct policy_elem* pe, block_sector_t sector)
+{
+    struct ghost* g = ghost_find(sector);
+    pe->sector = sector;
+    if (g != NULL && g->queue == ARC_B1) {
+        size_t delta = arc_b1.size >= arc_b2.size ? 1 : arc_b2.size / arc_b1.size;
+        arc_p = arc_p + delta < arc_c ? arc_p + delta : arc_c;
+        ghost_forget(&arc_b1, g);
+        pe->queue = ARC_T2;
+        queue_push_front(&arc_t2, &pe->elem);
+    } else if (g != NULL && g->queue == ARC_B2) {
+        size_t delta = arc_b2.size >= arc_b1.size ? 1 : arc_b1.size / arc_b2.size;
+        arc_p = arc_p > delta ? arc_p - delta : 0;
+        ghost_forget(&arc_b2, g);
+        pe->queue = ARC_T2;
+        queue_push_front(&arc_t2, &pe->elem);
+    } else {
+        pe->queue = ARC_T1;
+        queue_push_front(&arc_t1, &pe->elem);
+    }
+    arc_trim_ghosts();
+}
+
+static void arc_touch(struct policy_elem* pe)
+{
+    queue_remove(pe->queue == ARC_T1 ? &arc_t1 : &arc_t2, &pe->elem);
+    pe->queue = ARC_T2;
+    queue_push_front(&arc_t2, &pe->elem);
+}
+
+static void arc_remove(struct policy_elem* pe)
+{
+    queue_remove(pe->queue == ARC_T1 ? &arc_t1 : &arc_t2, &pe->elem);
+}
+
+/* Evicts from T1 (ghost in B1) or T2 (ghost in B2). */
+static struct policy_elem* arc_evict_from(bool from_t1, policy_claim_func* claim, void* aux, bool* stop)
+{
+    struct policy_elem* pe = scan_queue(from_t1 ? &arc_t1 : &arc_t2, claim, aux, stop);
+    if (pe != NULL) {
+        if (from_t1)
+            ghost_add(&arc_b1, ARC_B1, pe->sector);
+        else
+            ghost_add(&arc_b2, ARC_B2, pe->sector);
+    }
+    return pe;
+}
+
+static struct policy_elem* arc_evict(block_sector_t incoming, policy_claim_func* claim, void* aux)
+{
+    struct ghost* g = ghost_find(incoming);
+    bool in_b2 = g != NULL && g->queue == ARC_B2;
+    bool from_t1 = arc_t1.size > 0 && (arc_t1.size > arc_p || (in_b2 && arc_t1.size == arc_p));
+    bool stop = false;
+
+    struct policy_elem* pe = arc_evict_from(from_t1, claim, aux, &stop);
+    if (pe == NULL && !stop)
+        pe = arc_evict_from(!from_t1, claim, aux, &stop);
+    return pe;
+}
+
+/* All the policies, selectable by name.  The first is the default. */
+static const struct bufcache_policy policies[] = {
+    {"lru", lru_init, no_resize, lru_insert, lru_touch, lru_remove, lru_evict},
+    {"clock", clock_init, no_resize, clock_insert, clock_touch, clock_remove, clock_evict},
+    {"2q", twoq_init, twoq_resize, twoq_insert, twoq_touch, twoq_remove, twoq_evict},
+    {"arc", arc_init, arc_resize, arc_insert, arc_touch, arc_remove, arc_evict},
+};
+
+/* Returns the policy called NAME, or the default policy if NAME is a
+   null pointer.  Returns a null pointer if there is no such policy. */
+const struct bufcache_policy* bufcache_policy_lookup(const char* name)
+{
+    if (name == NULL)
+        return &policies[0];
+    for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+        if (!strcmp(name, policies[i].name))
+            return &policies[i];
+    return NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef FILESYS_BUFCACHE_POLICY_H
+#define FILESYS_BUFCACHE_POLICY_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Per-entry bookkeeping owned by the replacement policy.  It is embedded
+   in every buffer cache entry that holds a sector.  All policy functions
+   are called with the buffer cache's policy lock held. */
+struct policy_elem {
+    struct list_elem elem;      /* Position in one of the policy's queues. */
+    block_sector_t sector;      /* Sector held by the entry. */
+    int queue;                  /* Queue the entry is on, policy specific. */
+    bool referenced;            /* Reference bit, used by CLOCK. */
+};
+
+/* The cache's answer when the policy proposes a victim. */
+enum policy_verdict {
+    POLICY_TAKE,    /* The entry was claimed and leaves the policy. */
+    POLICY_SKIP,    /* The entry is busy; propose the next one. */
+    POLICY_STOP     /* Stop looking; the cache retries later. */
+};
+
+typedef enum policy_verdict policy_claim_func(struct policy_elem* e, void* aux);
+
+/* A buffer cache replacement policy. */
+struct bufcache_policy {
+    const char* name;
+
+    /* Prepares the policy for an empty cache. */
+    void (*init)(void);
+
+    /* The cache now has room for CAPACITY entries.  When it shrinks,
+       the entries that went away have already been removed. */
+    void (*resize)(size_t capacity);
+
+    /* E has just been filled with SECTOR, on a miss or a read-ahead. */
+    void (*insert)(struct policy_elem* e, block_sector_t sector);
+
+    /* E was hit. */
+    void (*touch)(struct policy_elem* e);
+
+    /* E is dropped from the cache without being evicted. */
+    void (*remove)(struct policy_elem* e);
+
+    /* Proposes victims to CLAIM, best first, to make room for INCOMING.
+       Returns the entry CLAIM took, or a null pointer. */
+    struct policy_elem* (*evict)(block_sector_t incoming, policy_claim_func* claim, void* aux);
+};
+
+const struct bufcache_policy* bufcache_policy_lookup(const char* name);
+
+#endif /* filesys/bufcache-policy.h */
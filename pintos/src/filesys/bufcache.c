@@ -1,192 +1,1036 @@
 #include <debug.h>
+#include <hash.h>
+#include <stdlib.h>
 #include <string.h>
 #include "filesys/bufcache.h"
+#include "filesys/bufcache-policy.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
 
-/* A buffer cache entry and its metadata. */
+/* A buffer cache entry and its metadata.
+
+   While an entry holds a sector, its state is protected by the lock of
+   the stripe that sector hashes to.  Rebinding an entry to another sector
+   additionally requires policy_lock and is only allowed while pin_cnt is 0. */
 struct bufcache_entry {
-    block_sector_t sector;
-    struct list_elem lru_elem;
-    struct condition until_ready;
-    bool ready;
+    block_sector_t sector;          /* Meaningful only while hashed. */
+    bool hashed;                    /* Holds a sector: in its stripe's index and the policy,
+                                       rather than in free_list.  Protected by policy_lock. */
+    struct hash_elem hash_elem;     /* Element in the stripe's sector index. */
+    struct policy_elem policy_elem; /* Owned by the policy, or in free_list.  Protected by policy_lock. */
+    struct condition until_ready;   /* Waited on with the stripe lock held. */
+    bool ready;                     /* False while the sector is read from disk. */
     bool dirty;
-    uint8_t data[BLOCK_SECTOR_SIZE];
+    int64_t dirty_since;            /* Tick at which the entry last became dirty. */
+    int pin_cnt;                    /* Threads using or waiting on this entry. */
+    int readers;                    /* Threads copying data out of this entry. */
+    bool writer;                    /* A thread is copying data into this entry. */
+    uint8_t* data;                  /* BLOCK_SECTOR_SIZE bytes in its chunk's pages. */
+};
+
+/* Entries are added and removed in chunks, whose data is CHUNK_PAGES pages
+   obtained from the page allocator. */
+#define CHUNK_PAGES 2
+#define CHUNK_ENTRIES (CHUNK_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
+struct bufcache_chunk {
+    struct list_elem elem;      /* Element in the list of chunks. */
+    void* pages;                /* Data of the entries below. */
+    struct bufcache_entry entries[CHUNK_ENTRIES];
 };
 
-#define NUM_ENTRIES 64
-#define INVALID_SECTOR 0xffff
+/* Cache sizing.  Unless set on the command line, the cache starts out
+   using 1/DEFAULT_RAM_FRACTION of RAM, which is 64 entries with 4 MB.
+   At runtime it grows up to MAX_GROWTH times its initial size while it
+   evicts and the kernel pool has more than 1/PLENTY_FRACTION of its pages
+   free, and shrinks down to 1/MAX_GROWTH of it when less than
+   1/LOW_FRACTION are free. */
+#define DEFAULT_RAM_FRACTION 128
+#define MAX_GROWTH 4
+#define PLENTY_FRACTION 4
+#define LOW_FRACTION 16
+
+#define NUM_STRIPES 16
+
+/* Returns true if SECTOR is virtual, and so must stay in the cache. */
+#define is_virtual(SECTOR) ((SECTOR) >= BUFCACHE_VIRTUAL_BASE)
+
+/* Converts a pointer to the policy_elem of an entry into the entry. */
+#define policy_entry(PE) \
+        ((struct bufcache_entry*) ((uint8_t*) (PE) - offsetof(struct bufcache_entry, policy_elem)))
+
+/* Write-behind tuning.  A dirty entry is written back by the flusher once it
+   is DIRTY_AGE ticks old, so a crash loses at most about
+   DIRTY_AGE + FLUSH_PERIOD ticks of data.  The flusher also wakes up early
+   and writes everything back once DIRTY_HIGH_WATER entries are dirty. */
+#define FLUSH_PERIOD (TIMER_FREQ / 2)
+#define DIRTY_AGE TIMER_FREQ
+#define DIRTY_HIGH_WATER (bufcache.num_entries / 2)
+
+/* Capacity of the queue of pending read-ahead requests. */
+#define PREFETCH_QUEUE_SIZE 64
+
+/* Most consecutive sectors read ahead with one block device request.  The
+   read-ahead thread claims this many entries at once, so it must stay well
+   below the smallest cache size. */
+#define MAX_RUN 8
+
+/* Most consecutive sectors written back with one block device request. */
+#define MAX_WRITE_RUN 32
+
+/* A lock stripe: guards the entries whose sectors hash to it. */
+struct bufcache_stripe {
+    struct lock lock;
+    struct hash index;  // Maps sector to the entry holding it
+    unsigned num_dirty; // Number of dirty entries in this stripe
+};
 
 /* A struct for the entire buffer cache. */
 struct bufcache{
-    struct bufcache_entry entries[NUM_ENTRIES];
-    struct lock cache_lock;
-    struct list lru_list;
+    struct lock chunks_lock;    // Protects chunks and num_entries; held while walking the entries
+    struct list chunks;
+    size_t num_entries;         // Current capacity, a multiple of CHUNK_ENTRIES
+    size_t min_entries, max_entries;
+    struct bufcache_stripe stripes[NUM_STRIPES];
+    const struct bufcache_policy* policy;   // Replacement policy
+    struct lock policy_lock;    // Protects the policy, free_list, the counters below and sector rebinding
+    struct list free_list;      // Entries holding no sector
     struct condition until_one_ready;
-    unsigned num_ready; // Number of buffer cache entries that are ready
+    unsigned evict_waiters;     // Number of threads looking for an evictable entry
+    bool flush_requested;       // Set when the dirty ratio crosses DIRTY_HIGH_WATER
+    bool stop_requested;        // Set by bufcache_stop() to make the flusher exit
+    struct semaphore flusher_stopped;   // Upped by the flusher as it exits
     int num_hits;       // Number of hits
     int num_accesses;   // Total number of accesses
+    unsigned num_evictions;     // Evictions since the flusher last resized the cache
+
+    /* Sectors waiting to be read ahead, serviced by the read-ahead thread. */
+    block_sector_t prefetch_queue[PREFETCH_QUEUE_SIZE];
+    size_t prefetch_head;       // Index of the oldest request
+    size_t prefetch_cnt;        // Number of queued requests
+    struct lock prefetch_lock;
+    struct condition prefetch_pending;
+};
+
+/* State shared with claim_entry() while the policy proposes victims. */
+struct claim_context {
+    struct bufcache_stripe* stripe;     // Stripe of the incoming sector, locked by the evictor
+    struct bufcache_stripe* owner;      // Stripe of the accepted entry, locked by the evictor
+    struct bufcache_entry* dirty;       // Accepted entry that must be cleaned before eviction
+    bool contended;                     // Whether a locked stripe made us skip an entry
 };
 
 /* The buffer cache maintained by OS. */
 static struct bufcache bufcache;
 
-/* Internal helper functions that assume the caller already holds the cache_lock. */
-static struct bufcache_entry* get_eviction_candidate(void);
-static struct bufcache_entry* find(block_sector_t sector);
-static void clean(struct bufcache_entry* entry);
-static void replace(struct bufcache_entry* entry, block_sector_t sector);
+/* Replacement policy to use, chosen on the kernel command line. */
+static const struct bufcache_policy* selected_policy;
+
+/* Initial number of entries chosen on the kernel command line, or 0. */
+static size_t selected_size;
+
+/* Internal helper functions.  Those taking a stripe assume the caller holds its lock. */
+static struct bufcache_stripe* stripe_of(block_sector_t sector);
+static struct bufcache_entry* find(struct bufcache_stripe* stripe, block_sector_t sector);
+static struct bufcache_entry* get_eviction_candidate(struct bufcache_stripe* stripe, block_sector_t sector);
+static void clean(struct bufcache_entry* entry, struct bufcache_stripe* stripe);
+static void replace(struct bufcache_entry* entry, struct bufcache_stripe* stripe);
+static void mark_ready(struct bufcache_entry* entry, struct bufcache_stripe* stripe);
+static enum policy_verdict claim_entry(struct policy_elem* pe, void* aux);
+static void touch(struct bufcache_entry* entry, bool is_hit);
+static void count_miss(void);
+static void unpin(struct bufcache_entry* entry, struct bufcache_stripe* stripe);
+static void begin_access(struct bufcache_entry* entry, struct bufcache_stripe* stripe, bool exclusive);
+static void end_access(struct bufcache_entry* entry, struct bufcache_stripe* stripe, bool dirty);
+static void mark_dirty(struct bufcache_entry* entry, struct bufcache_stripe* stripe);
+static struct bufcache_entry* find_pinned(struct bufcache_stripe* stripe, block_sector_t sector);
 static struct bufcache_entry* bufcache_access(block_sector_t sector, bool blind);
+static unsigned dirty_count(void);
+static int compare_sectors(const void* a_, const void* b_);
+static void clean_sector(block_sector_t sector);
+static struct bufcache_entry* begin_writeback(block_sector_t sector, bool wait, bool* busy);
+static void end_writeback(struct bufcache_entry* entry);
+static void write_sorted(const block_sector_t* sectors, size_t cnt);
+static void writeback(int64_t min_age);
+static bool grow(void);
+static bool shrink(void);
+static void resize(void);
+static thread_func flusher;
+static struct bufcache_entry* claim_for_prefetch(block_sector_t sector);
+static void prefetch_sorted(const block_sector_t* sectors, size_t cnt);
+static thread_func prefetcher;
+
+/* Hash function and comparator for the sector index. */
+static unsigned entry_hash(const struct hash_elem* e, void* aux UNUSED)
+{
+    return hash_int(hash_entry(e, struct bufcache_entry, hash_elem)->sector);
+}
 
-/* Initialize the entire buffer cache by initializing all the locks and conditional variables. */
+static bool entry_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED)
+{
+    return hash_entry(a, struct bufcache_entry, hash_elem)->sector
+           < hash_entry(b, struct bufcache_entry, hash_elem)->sector;
+}
+
+/* Initialize the entire buffer cache by initializing all the locks and conditional variables,
+   and allocate its initial entries. */
 void bufcache_init(void)
 {
-    list_init(& (bufcache.lru_list));
-    lock_init(& (bufcache.cache_lock));
+    for(int i = 0; i < NUM_STRIPES; i++){
+        lock_init(&bufcache.stripes[i].lock);
+        bufcache.stripes[i].num_dirty = 0;
+        if (!hash_init(&bufcache.stripes[i].index, entry_hash, entry_less, NULL))
+            PANIC("bufcache index creation failed");
+    }
+    if (selected_policy == NULL)
+        selected_policy = bufcache_policy_lookup(NULL);
+    bufcache.policy = selected_policy;
+    bufcache.policy->init();
+    list_init(& (bufcache.free_list));
+    lock_init(& (bufcache.policy_lock));
     cond_init(& (bufcache.until_one_ready));
-    bufcache.num_ready = NUM_ENTRIES;
+    bufcache.evict_waiters = 0;
+    bufcache.flush_requested = false;
+    bufcache.stop_requested = false;
+    sema_init(&bufcache.flusher_stopped, 0);
     bufcache.num_hits = 0;
     bufcache.num_accesses = 0;
-    for(int i = 0; i < NUM_ENTRIES; i++){
-        cond_init(& (bufcache.entries[i].until_ready));
-        bufcache.entries[i].dirty = false;
-        bufcache.entries[i].ready = true;
-        bufcache.entries[i].sector = INVALID_SECTOR;
-        list_push_front(&(bufcache.lru_list), &(bufcache.entries[i].lru_elem));
-    }
+    bufcache.num_evictions = 0;
+    bufcache.prefetch_head = 0;
+    bufcache.prefetch_cnt = 0;
+    lock_init(&bufcache.prefetch_lock);
+    cond_init(&bufcache.prefetch_pending);
+
+    size_t size = selected_size;
+    if (size == 0)
+        size = (size_t) init_ram_pages * PGSIZE / DEFAULT_RAM_FRACTION / BLOCK_SECTOR_SIZE;
+    size = (size + CHUNK_ENTRIES - 1) / CHUNK_ENTRIES * CHUNK_ENTRIES;
+    if (size < CHUNK_ENTRIES)
+        size = CHUNK_ENTRIES;
+    bufcache.min_entries = size / MAX_GROWTH / CHUNK_ENTRIES * CHUNK_ENTRIES;
+    if (bufcache.min_entries < CHUNK_ENTRIES)
+        bufcache.min_entries = CHUNK_ENTRIES;
+    bufcache.max_entries = size * MAX_GROWTH;
+    lock_init(&bufcache.chunks_lock);
+    list_init(&bufcache.chunks);
+    bufcache.num_entries = 0;
+    lock_acquire(&bufcache.chunks_lock);
+    while (bufcache.num_entries < size && grow())
+        continue;
+    lock_release(&bufcache.chunks_lock);
+    if (bufcache.num_entries == 0)
+        PANIC("bufcache: no memory for entries");
+
+    thread_create("bufcache-flush", PRI_DEFAULT, flusher, NULL);
+    thread_create("bufcache-ahead", PRI_DEFAULT, prefetcher, NULL);
 }
 
-/* Return the last bufcache_entry in the list that is also ready. Otherwise, return NULL. */
-static struct bufcache_entry* get_eviction_candidate(void){
-    ASSERT(lock_held_by_current_thread(&bufcache.cache_lock));
-    if(bufcache.num_ready == 0){
-        return NULL;
+/* Start the cache out with SIZE entries, rounded up to whole chunks,
+   instead of sizing it from the amount of RAM.  Must be called before bufcache_init(). */
+void bufcache_set_size(size_t size)
+{
+    selected_size = size;
+}
+
+/* Use the replacement policy called NAME.  Must be called before bufcache_init().
+   Returns false if there is no such policy. */
+bool bufcache_select_policy(const char* name)
+{
+    const struct bufcache_policy* policy = bufcache_policy_lookup(name);
+    if (policy == NULL)
+        return false;
+    selected_policy = policy;
+    return true;
+}
+
+/* Return the lock stripe responsible for SECTOR. */
+static struct bufcache_stripe* stripe_of(block_sector_t sector)
+{
+    return &bufcache.stripes[hash_int(sector) % NUM_STRIPES];
+}
+
+/* Return a bufcache_entry with matching sector. Otherwise, return NULL. */
+static struct bufcache_entry* find(struct bufcache_stripe* stripe, block_sector_t sector)
+{
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
+    struct bufcache_entry key;
+    key.sector = sector;
+    struct hash_elem* e = hash_find(&stripe->index, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct bufcache_entry, hash_elem) : NULL;
+}
+
+/* Policy callback: accept the entry behind PE as a victim if nobody is using it.
+   On acceptance the entry's stripe is left locked in the claim_context. */
+static enum policy_verdict claim_entry(struct policy_elem* pe, void* aux)
+{
+    struct claim_context* ctx = aux;
+    struct bufcache_entry* candidate = policy_entry(pe);
+    struct bufcache_stripe* owner = stripe_of(candidate->sector);
+
+    /* Stripes are never waited on while holding another one. */
+    if (owner != ctx->stripe && !lock_try_acquire(&owner->lock)) {
+        ctx->contended = true;
+        return POLICY_SKIP;
     }
-    struct bufcache_entry* candidate = list_entry(list_back(&(bufcache.lru_list)), struct bufcache_entry, lru_elem);
-    /* entry farthest back in the lru_list where ready == true */
-    while(candidate->ready == false){
-        candidate = list_entry(list_prev(&(candidate->lru_elem)), struct bufcache_entry, lru_elem);
+    if (candidate->pin_cnt > 0 || is_virtual(candidate->sector)) {
+        if (owner != ctx->stripe)
+            lock_release(&owner->lock);
+        return POLICY_SKIP;
     }
-    return candidate;
+    ctx->owner = owner;
+    if (candidate->dirty) {
+        ctx->dirty = candidate;
+        return POLICY_STOP;
+    }
+    return POLICY_TAKE;
 }
 
-/* Return a bufcache_entry with matching sector. Otherwise, return NULL. */
-static struct bufcache_entry* find(block_sector_t sector)
+/* Claim a free entry, or the victim chosen by the replacement policy, and rebind it
+   to SECTOR, which belongs to STRIPE.  Returns the entry pinned and not yet ready.
+
+   If the victim is dirty, it is written back instead; if nothing can be evicted
+   right now, waits until an entry is unpinned.  In both cases returns NULL with
+   STRIPE's lock released, and the caller should look SECTOR up again. */
+static struct bufcache_entry* get_eviction_candidate(struct bufcache_stripe* stripe, block_sector_t sector)
 {
-    for(int i = 0; i < NUM_ENTRIES; i++){
-        if(bufcache.entries[i].sector == sector){
-            return &(bufcache.entries[i]);
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
+    struct claim_context ctx = {stripe, NULL, NULL, false};
+    struct bufcache_entry* victim = NULL;
+    lock_acquire(&bufcache.policy_lock);
+    bufcache.evict_waiters++;
+    if (!list_empty(&bufcache.free_list)) {
+        victim = list_entry(list_pop_front(&bufcache.free_list), struct bufcache_entry, policy_elem.elem);
+    } else {
+        struct policy_elem* pe = bufcache.policy->evict(sector, claim_entry, &ctx);
+        if (pe != NULL) {
+            victim = policy_entry(pe);
+            bufcache.num_evictions++;
         }
     }
+
+    if (victim != NULL) {
+        bufcache.evict_waiters--;
+        if (ctx.owner != NULL)
+            hash_delete(&ctx.owner->index, &victim->hash_elem);
+        victim->sector = sector;
+        victim->hashed = true;
+        hash_insert(&stripe->index, &victim->hash_elem);
+        victim->pin_cnt = 1;
+        victim->ready = false;
+        bufcache.policy->insert(&victim->policy_elem, sector);
+        if (ctx.owner != NULL && ctx.owner != stripe)
+            lock_release(&ctx.owner->lock);
+        lock_release(&bufcache.policy_lock);
+        return victim;
+    }
+
+    if (ctx.dirty != NULL) {
+        bufcache.evict_waiters--;
+        ctx.dirty->pin_cnt++;
+        lock_release(&bufcache.policy_lock);
+        if (ctx.owner != stripe)
+            lock_release(&stripe->lock);
+        clean(ctx.dirty, ctx.owner);
+        unpin(ctx.dirty, ctx.owner);
+        lock_release(&ctx.owner->lock);
+        return NULL;
+    }
+
+    /* Nothing is evictable.  Skipped stripes may free up without anyone
+       signalling us, so only sleep if every entry was seen pinned. */
+    lock_release(&stripe->lock);
+    if (!ctx.contended)
+        cond_wait(&bufcache.until_one_ready, &bufcache.policy_lock);
+    bufcache.evict_waiters--;
+    lock_release(&bufcache.policy_lock);
+    if (ctx.contended)
+        thread_yield();
     return NULL;
 }
 
-/* Write back an entry inside bufcache to the disk. */
-static void clean(struct bufcache_entry* entry)
+/* Write back an entry inside bufcache to the disk.  The caller must have ENTRY pinned. */
+static void clean(struct bufcache_entry* entry, struct bufcache_stripe* stripe)
 {
-    ASSERT(lock_held_by_current_thread(&(bufcache.cache_lock)));
-    ASSERT(entry->dirty);
-    entry->ready = false;
-    bufcache.num_ready--;
-    lock_release(&(bufcache.cache_lock));
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
+    ASSERT(entry->pin_cnt > 0);
+    begin_access(entry, stripe, false);
+    if (entry->dirty) {
+        entry->dirty = false;
+        stripe->num_dirty--;
+        lock_release(&stripe->lock);
 
-    /* Write to disk. */
-    block_write(fs_device, entry->sector , &(entry->data));
+        /* Write to disk.  Other readers may keep using the entry meanwhile. */
+        block_write(fs_device, entry->sector, entry->data);
+
+        lock_acquire(&stripe->lock);
+    }
+    end_access(entry, stripe, false);
+}
+
+/* Read an entry in bufcache from the disk, once it has been bound to its new sector. */
+static void replace(struct bufcache_entry* entry, struct bufcache_stripe* stripe)
+{
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
+    ASSERT(!entry->ready && !entry->dirty);
+    ASSERT(!is_virtual(entry->sector));
+    lock_release(&stripe->lock);
 
-    lock_acquire(&(bufcache.cache_lock));
-    entry->ready = true;
-    bufcache.num_ready++;
-    entry->dirty = false;
-    cond_broadcast(&entry->until_ready, &(bufcache.cache_lock));
-    cond_broadcast(&bufcache.until_one_ready, &(bufcache.cache_lock));
-}
-
-/* Read an entry in bufcache from the disk. */
-static void replace(struct bufcache_entry* entry, block_sector_t sector)
-{
-    ASSERT(lock_held_by_current_thread(&bufcache.cache_lock));
-    ASSERT(!entry->dirty);
-    entry->sector = sector;
-    entry->ready = false;
-    bufcache.num_ready--;
-    lock_release(&bufcache.cache_lock);
-    
     /* Read from disk */
-    block_read(fs_device, sector, &(entry->data));
-    
-    lock_acquire(&bufcache.cache_lock);
+    block_read(fs_device, entry->sector, entry->data);
+
+    lock_acquire(&stripe->lock);
+    mark_ready(entry, stripe);
+}
+
+/* Let the threads waiting for ENTRY's data use it. */
+static void mark_ready(struct bufcache_entry* entry, struct bufcache_stripe* stripe)
+{
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
     entry->ready = true;
-    bufcache.num_ready++;
-    cond_broadcast(&entry->until_ready, &(bufcache.cache_lock));
-    cond_broadcast(&bufcache.until_one_ready, &(bufcache.cache_lock));
+    cond_broadcast(&entry->until_ready, &stripe->lock);
 }
 
-/* Look inside bufcache for an entry with matching sector, and this might involve eviction. */
-static struct bufcache_entry* bufcache_access(block_sector_t sector, bool blind)
+/* Tell the policy that cached ENTRY was referenced and count the access. */
+static void touch(struct bufcache_entry* entry, bool is_hit)
 {
-    ASSERT(lock_held_by_current_thread(&bufcache.cache_lock));
+    lock_acquire(&bufcache.policy_lock);
+    bufcache.policy->touch(&entry->policy_elem);
     bufcache.num_accesses += 1;
+    if (is_hit)
+        bufcache.num_hits += 1;
+    lock_release(&bufcache.policy_lock);
+}
+
+/* Count an access that had to claim a new entry. */
+static void count_miss(void)
+{
+    lock_acquire(&bufcache.policy_lock);
+    bufcache.num_accesses += 1;
+    lock_release(&bufcache.policy_lock);
+}
+
+/* Drop one pin on ENTRY, waking up evictors once it becomes evictable. */
+static void unpin(struct bufcache_entry* entry, struct bufcache_stripe* stripe)
+{
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
+    ASSERT(entry->pin_cnt > 0);
+    if (--entry->pin_cnt == 0 && bufcache.evict_waiters > 0) {
+        lock_acquire(&bufcache.policy_lock);
+        cond_broadcast(&bufcache.until_one_ready, &bufcache.policy_lock);
+        lock_release(&bufcache.policy_lock);
+    }
+}
+
+/* Wait until ENTRY is ready and can be shared, or owned if EXCLUSIVE, then take that access. */
+static void begin_access(struct bufcache_entry* entry, struct bufcache_stripe* stripe, bool exclusive)
+{
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
+    while (!entry->ready || entry->writer || (exclusive && entry->readers > 0))
+        cond_wait(&entry->until_ready, &stripe->lock);
+    if (exclusive)
+        entry->writer = true;
+    else
+        entry->readers++;
+}
+
+/* Give up the access taken by begin_access(), marking ENTRY dirty if DIRTY. */
+static void end_access(struct bufcache_entry* entry, struct bufcache_stripe* stripe, bool dirty)
+{
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
+    if (entry->writer)
+        entry->writer = false;
+    else
+        entry->readers--;
+    if (dirty)
+        mark_dirty(entry, stripe);
+    if (entry->readers == 0)
+        cond_broadcast(&entry->until_ready, &stripe->lock);
+}
+
+/* Mark ENTRY dirty, waking up the flusher early if too much of the cache is dirty. */
+static void mark_dirty(struct bufcache_entry* entry, struct bufcache_stripe* stripe)
+{
+    ASSERT(lock_held_by_current_thread(&stripe->lock));
+    if (!entry->dirty) {
+        entry->dirty = true;
+        entry->dirty_since = timer_ticks();
+        stripe->num_dirty++;
+        if (dirty_count() >= DIRTY_HIGH_WATER)
+            bufcache.flush_requested = true;
+    }
+}
+
+/* Look inside bufcache for an entry with matching sector, and this might involve eviction.
+   Returns the entry pinned, with the lock of its stripe held. */
+static struct bufcache_entry* bufcache_access(block_sector_t sector, bool blind)
+{
+    struct bufcache_stripe* stripe = stripe_of(sector);
     bool is_hit = true;
+    lock_acquire(&stripe->lock);
     while(true){
-        struct bufcache_entry* match = find(sector);
+        struct bufcache_entry* match = find(stripe, sector);
         if(match != NULL){
-            if(!match->ready){
-                cond_wait(&match->until_ready, &bufcache.cache_lock);
-                continue;
-            }
-            /* Move match to front. */
-            if (is_hit) {
-                bufcache.num_hits += 1;
-                is_hit = false;
-            }
-            list_remove(&(match->lru_elem));
-            list_push_front(&(bufcache.lru_list), &(match->lru_elem));
+            match->pin_cnt++;
+            touch(match, is_hit);
             return match;
         }
         is_hit = false;
-        struct bufcache_entry* to_evict = get_eviction_candidate();
-        if(to_evict == NULL){
-            cond_wait(&bufcache.until_one_ready, &bufcache.cache_lock);
-        }else if (to_evict->dirty){
-            clean(to_evict);
-        }else if (blind){
-            to_evict->sector = sector;
-            /* on next iteration, find() should succeed */
-        } else {
-            replace(to_evict, sector);
+        struct bufcache_entry* claimed = get_eviction_candidate(stripe, sector);
+        if (claimed != NULL) {
+            count_miss();
+            if (blind) {
+                mark_ready(claimed, stripe);
+            } else {
+                replace(claimed, stripe);
+            }
+            return claimed;
+        }
+        lock_acquire(&stripe->lock);
+    }
+}
+
+/* Claim an entry for reading SECTOR ahead, unless it is cached already.
+   Returns the entry pinned and not yet ready, or NULL. */
+static struct bufcache_entry* claim_for_prefetch(block_sector_t sector)
+{
+    struct bufcache_stripe* stripe = stripe_of(sector);
+    struct bufcache_entry* claimed = NULL;
+    lock_acquire(&stripe->lock);
+    while (find(stripe, sector) == NULL) {
+        claimed = get_eviction_candidate(stripe, sector);
+        if (claimed != NULL)
+            break;
+        lock_acquire(&stripe->lock);
+    }
+    lock_release(&stripe->lock);
+    return claimed;
+}
+
+/* Bring the sectors among SECTORS[0..CNT), which are sorted, into the cache if they
+   are not there yet, without counting accesses.  Consecutive sectors are read with
+   one request. */
+static void prefetch_sorted(const block_sector_t* sectors, size_t cnt)
+{
+    ASSERT(cnt <= MAX_RUN);
+    size_t i = 0;
+    while (i < cnt) {
+        struct bufcache_entry* run[MAX_RUN];
+        void* buffers[MAX_RUN];
+        size_t len = 0;
+        while (i < cnt && (len == 0 || sectors[i] == run[len - 1]->sector + 1)) {
+            struct bufcache_entry* entry = claim_for_prefetch(sectors[i++]);
+            if (entry == NULL) {
+                if (len > 0)
+                    break;
+                continue;
+            }
+            run[len] = entry;
+            buffers[len] = entry->data;
+            len++;
+        }
+        if (len == 0)
+            continue;
+
+        block_read_multi(fs_device, run[0]->sector, len, buffers);
+        for(size_t j = 0; j < len; j++){
+            struct bufcache_stripe* stripe = stripe_of(run[j]->sector);
+            lock_acquire(&stripe->lock);
+            mark_ready(run[j], stripe);
+            unpin(run[j], stripe);
+            lock_release(&stripe->lock);
+        }
+    }
+}
+
+/* Read-ahead thread: services the requests queued by bufcache_prefetch(), up to
+   MAX_RUN at a time so that neighbouring sectors are read together. */
+static void prefetcher(void* aux UNUSED)
+{
+    for(;;){
+        block_sector_t batch[MAX_RUN];
+        size_t cnt = 0;
+        lock_acquire(&bufcache.prefetch_lock);
+        while (bufcache.prefetch_cnt == 0)
+            cond_wait(&bufcache.prefetch_pending, &bufcache.prefetch_lock);
+        while (bufcache.prefetch_cnt > 0 && cnt < MAX_RUN) {
+            batch[cnt++] = bufcache.prefetch_queue[bufcache.prefetch_head];
+            bufcache.prefetch_head = (bufcache.prefetch_head + 1) % PREFETCH_QUEUE_SIZE;
+            bufcache.prefetch_cnt--;
         }
+        lock_release(&bufcache.prefetch_lock);
+
+        qsort(batch, cnt, sizeof *batch, compare_sectors);
+        prefetch_sorted(batch, cnt);
     }
 }
 
-/* The following three functions are external API. */
+/* The following functions are external API. */
 void bufcache_read (block_sector_t sector, void* buffer, size_t offset, size_t length)
 {
     ASSERT(offset + length <= BLOCK_SECTOR_SIZE);
-    lock_acquire(&bufcache.cache_lock);
+    struct bufcache_stripe* stripe = stripe_of(sector);
     struct bufcache_entry* entry = bufcache_access(sector, false);
+    begin_access(entry, stripe, false);
+    lock_release(&stripe->lock);
+
     memcpy(buffer, &entry->data[offset], length);
-    lock_release(&bufcache.cache_lock);
+
+    lock_acquire(&stripe->lock);
+    end_access(entry, stripe, false);
+    unpin(entry, stripe);
+    lock_release(&stripe->lock);
 }
 
 void bufcache_write(block_sector_t sector, const void* buffer, size_t offset, size_t length)
 {
     ASSERT(offset + length <= BLOCK_SECTOR_SIZE);
-    lock_acquire(&bufcache.cache_lock);
+    struct bufcache_stripe* stripe = stripe_of(sector);
     struct bufcache_entry* entry = bufcache_access(sector, length == BLOCK_SECTOR_SIZE);
+    begin_access(entry, stripe, true);
+    lock_release(&stripe->lock);
+
     memcpy(&entry->data[offset], buffer, length);
-    entry->dirty = true;
-    lock_release(&bufcache.cache_lock);
+
+    lock_acquire(&stripe->lock);
+    end_access(entry, stripe, true);
+    unpin(entry, stripe);
+    lock_release(&stripe->lock);
 }
 
-void bufcache_flush(void)
+/* Install SECTOR in the cache as all zeros, without reading it from disk, and mark it
+   dirty.  Used for blocks that are allocated and must start out zeroed. */
+void bufcache_zero(block_sector_t sector)
+{
+    struct bufcache_stripe* stripe = stripe_of(sector);
+    struct bufcache_entry* entry = bufcache_access(sector, true);
+    begin_access(entry, stripe, true);
+    lock_release(&stripe->lock);
+
+    memset(entry->data, 0, BLOCK_SECTOR_SIZE);
+
+    lock_acquire(&stripe->lock);
+    end_access(entry, stripe, true);
+    unpin(entry, stripe);
+    lock_release(&stripe->lock);
+}
+
+/* Pin SECTOR in the cache and return a pointer to its BLOCK_SECTOR_SIZE bytes of data,
+   which the caller may read, or also modify if EXCLUSIVE.  Other threads wait to
+   modify the sector until it is released with bufcache_put(), and, if EXCLUSIVE,
+   to read it too.  A thread must not get the same sector twice. */
+void* bufcache_get(block_sector_t sector, bool exclusive)
+{
+    struct bufcache_stripe* stripe = stripe_of(sector);
+    struct bufcache_entry* entry = bufcache_access(sector, false);
+    begin_access(entry, stripe, exclusive);
+    lock_release(&stripe->lock);
+    return entry->data;
+}
+
+/* Return the entry of SECTOR, which the caller has pinned with bufcache_get(). */
+static struct bufcache_entry* find_pinned(struct bufcache_stripe* stripe, block_sector_t sector)
+{
+    struct bufcache_entry* entry = find(stripe, sector);
+    ASSERT(entry != NULL && entry->pin_cnt > 0);
+    return entry;
+}
+
+/* Record that the data of SECTOR, obtained exclusively with bufcache_get(), was modified. */
+void bufcache_mark_dirty(block_sector_t sector)
+{
+    struct bufcache_stripe* stripe = stripe_of(sector);
+    lock_acquire(&stripe->lock);
+    struct bufcache_entry* entry = find_pinned(stripe, sector);
+    ASSERT(entry->writer);
+    mark_dirty(entry, stripe);
+    lock_release(&stripe->lock);
+}
+
+/* Release SECTOR, obtained with bufcache_get().  Its data must not be used afterwards. */
+void bufcache_put(block_sector_t sector)
 {
-    lock_acquire(&bufcache.cache_lock);
-    for(int i = 0; i < NUM_ENTRIES; i++){
-        if (bufcache.entries[i].dirty) {
-            clean(&bufcache.entries[i]);
+    struct bufcache_stripe* stripe = stripe_of(sector);
+    lock_acquire(&stripe->lock);
+    struct bufcache_entry* entry = find_pinned(stripe, sector);
+    end_access(entry, stripe, false);
+    unpin(entry, stripe);
+    lock_release(&stripe->lock);
+}
+
+/* Copy the data of virtual sector FROM to sector TO, which is installed without
+   reading it from disk.  TO counts as dirty since FROM became dirty, so that giving
+   held-back data its sector does not put off writing it back. */
+void bufcache_move(block_sector_t from, block_sector_t to)
+{
+    struct bufcache_stripe* from_stripe = stripe_of(from);
+    struct bufcache_stripe* to_stripe = stripe_of(to);
+    const void* data = bufcache_get(from, false);
+    lock_acquire(&from_stripe->lock);
+    struct bufcache_entry* source = find_pinned(from_stripe, from);
+    bool dirty = source->dirty;
+    int64_t dirty_since = source->dirty_since;
+    lock_release(&from_stripe->lock);
+
+    struct bufcache_entry* entry = bufcache_access(to, true);
+    begin_access(entry, to_stripe, true);
+    lock_release(&to_stripe->lock);
+
+    memcpy(entry->data, data, BLOCK_SECTOR_SIZE);
+
+    lock_acquire(&to_stripe->lock);
+    end_access(entry, to_stripe, true);
+    if (dirty && dirty_since < entry->dirty_since)
+        entry->dirty_since = dirty_since;
+    unpin(entry, to_stripe);
+    lock_release(&to_stripe->lock);
+    bufcache_put(from);
+}
+
+/* Drop SECTOR from the cache, if it is there, without writing it back.
+   Nobody may be using it.  Meant for virtual sectors. */
+void bufcache_discard(block_sector_t sector)
+{
+    struct bufcache_stripe* stripe = stripe_of(sector);
+    lock_acquire(&stripe->lock);
+    struct bufcache_entry* entry = find(stripe, sector);
+    if (entry != NULL) {
+        ASSERT(entry->pin_cnt == 0);
+        if (entry->dirty) {
+            entry->dirty = false;
+            stripe->num_dirty--;
         }
+        lock_acquire(&bufcache.policy_lock);
+        hash_delete(&stripe->index, &entry->hash_elem);
+        bufcache.policy->remove(&entry->policy_elem);
+        list_push_back(&bufcache.free_list, &entry->policy_elem.elem);
+        entry->hashed = false;
+        if (bufcache.evict_waiters > 0)
+            cond_broadcast(&bufcache.until_one_ready, &bufcache.policy_lock);
+        lock_release(&bufcache.policy_lock);
     }
-    lock_release(&bufcache.cache_lock);
+    lock_release(&stripe->lock);
+}
+
+/* Return the number of entries the cache has room for right now. */
+size_t bufcache_size(void)
+{
+    return bufcache.num_entries;
+}
+
+/* Return the number of dirty entries.  Reads the per-stripe counts without
+   locking, so the result is only a hint. */
+static unsigned dirty_count(void)
+{
+    unsigned cnt = 0;
+    for(int i = 0; i < NUM_STRIPES; i++)
+        cnt += bufcache.stripes[i].num_dirty;
+    return cnt;
+}
+
+/* Orders sectors for qsort(). */
+static int compare_sectors(const void* a_, const void* b_)
+{
+    const block_sector_t* a = a_;
+    const block_sector_t* b = b_;
+    return *a < *b ? -1 : *a > *b;
+}
+
+/* Write back SECTOR if it is cached and dirty. */
+static void clean_sector(block_sector_t sector)
+{
+    struct bufcache_stripe* stripe = stripe_of(sector);
+    lock_acquire(&stripe->lock);
+    struct bufcache_entry* entry = find(stripe, sector);
+    if (entry != NULL && entry->dirty) {
+        entry->pin_cnt++;
+        clean(entry, stripe);
+        unpin(entry, stripe);
+    }
+    lock_release(&stripe->lock);
+}
+
+/* Take SECTOR for writing it back if it is cached and dirty: pin it, get shared
+   access to it and mark it clean.  Unless WAIT, sets *BUSY instead of waiting
+   for the sector to be read or written.  Returns the entry, or NULL. */
+static struct bufcache_entry* begin_writeback(block_sector_t sector, bool wait, bool* busy)
+{
+    struct bufcache_stripe* stripe = stripe_of(sector);
+    struct bufcache_entry* taken = NULL;
+    *busy = false;
+    lock_acquire(&stripe->lock);
+    struct bufcache_entry* entry = find(stripe, sector);
+    if (entry != NULL && entry->dirty) {
+        if (!wait && (!entry->ready || entry->writer)) {
+            *busy = true;
+        } else {
+            entry->pin_cnt++;
+            begin_access(entry, stripe, false);
+            if (entry->dirty) {
+                entry->dirty = false;
+                stripe->num_dirty--;
+                taken = entry;
+            } else {
+                end_access(entry, stripe, false);
+                unpin(entry, stripe);
+            }
+        }
+    }
+    lock_release(&stripe->lock);
+    return taken;
+}
+
+/* Release ENTRY, taken by begin_writeback(), once it has been written. */
+static void end_writeback(struct bufcache_entry* entry)
+{
+    struct bufcache_stripe* stripe = stripe_of(entry->sector);
+    lock_acquire(&stripe->lock);
+    end_access(entry, stripe, false);
+    unpin(entry, stripe);
+    lock_release(&stripe->lock);
+}
+
+/* Write back the dirty sectors among SECTORS[0..CNT), which are sorted,
+   coalescing up to MAX_WRITE_RUN consecutive sectors into one request. */
+static void write_sorted(const block_sector_t* sectors, size_t cnt)
+{
+    size_t i = 0;
+    while (i < cnt) {
+        struct bufcache_entry* run[MAX_WRITE_RUN];
+        const void* buffers[MAX_WRITE_RUN];
+        size_t len = 0;
+        while (i < cnt && len < MAX_WRITE_RUN && (len == 0 || sectors[i] == run[len - 1]->sector + 1)) {
+            /* Only the first sector of a run may wait: we must not wait for a
+               writer while holding access to other entries. */
+            bool busy;
+            struct bufcache_entry* entry = begin_writeback(sectors[i], len == 0, &busy);
+            if (busy)
+                break;
+            i++;
+            if (entry == NULL) {
+                if (len > 0)
+                    break;
+                continue;
+            }
+            run[len] = entry;
+            buffers[len] = entry->data;
+            len++;
+        }
+        if (len == 0)
+            continue;
+
+        block_write_multi(fs_device, run[0]->sector, len, buffers);
+        for(size_t j = 0; j < len; j++)
+            end_writeback(run[j]);
+    }
+}
+
+/* Write back every entry that has been dirty for at least MIN_AGE ticks,
+   in ascending sector order so the disk head sweeps once, and with one
+   request per run of consecutive sectors. */
+static void writeback(int64_t min_age)
+{
+    lock_acquire(&bufcache.chunks_lock);
+    block_sector_t* sectors = malloc(bufcache.num_entries * sizeof *sectors);
+
+    /* Snapshot the candidates without locking, then recheck each one.
+       Without memory for sorting, write them back in cache order. */
+    size_t cnt = 0;
+    for (struct list_elem* e = list_begin(&bufcache.chunks); e != list_end(&bufcache.chunks); e = list_next(e)) {
+        struct bufcache_chunk* chunk = list_entry(e, struct bufcache_chunk, elem);
+        for(int i = 0; i < CHUNK_ENTRIES; i++){
+            struct bufcache_entry* entry = &chunk->entries[i];
+            block_sector_t sector = entry->sector;
+            if (!entry->hashed || is_virtual(sector) || !entry->dirty
+                || timer_elapsed(entry->dirty_since) < min_age)
+                continue;
+            if (sectors != NULL)
+                sectors[cnt++] = sector;
+            else
+                clean_sector(sector);
+        }
+    }
+
+    if (sectors != NULL) {
+        qsort(sectors, cnt, sizeof *sectors, compare_sectors);
+        write_sorted(sectors, cnt);
+        free(sectors);
+    }
+    lock_release(&bufcache.chunks_lock);
+}
+
+/* Add a chunk of free entries to the cache.  Returns false if there is no
+   memory for it.  The caller must hold chunks_lock. */
+static bool grow(void)
+{
+    ASSERT(lock_held_by_current_thread(&bufcache.chunks_lock));
+    struct bufcache_chunk* chunk = malloc(sizeof *chunk);
+    if (chunk == NULL)
+        return false;
+    chunk->pages = palloc_get_multiple(0, CHUNK_PAGES);
+    if (chunk->pages == NULL) {
+        free(chunk);
+        return false;
+    }
+    for(int i = 0; i < CHUNK_ENTRIES; i++){
+        struct bufcache_entry* entry = &chunk->entries[i];
+        cond_init(&entry->until_ready);
+        entry->dirty = false;
+        entry->ready = true;
+        entry->pin_cnt = 0;
+        entry->readers = 0;
+        entry->writer = false;
+        entry->hashed = false;
+        entry->data = (uint8_t*) chunk->pages + i * BLOCK_SECTOR_SIZE;
+    }
+
+    lock_acquire(&bufcache.policy_lock);
+    for(int i = 0; i < CHUNK_ENTRIES; i++)
+        list_push_back(&bufcache.free_list, &chunk->entries[i].policy_elem.elem);
+    list_push_back(&bufcache.chunks, &chunk->elem);
+    bufcache.num_entries += CHUNK_ENTRIES;
+    bufcache.policy->resize(bufcache.num_entries);
+    if (bufcache.evict_waiters > 0)
+        cond_broadcast(&bufcache.until_one_ready, &bufcache.policy_lock);
+    lock_release(&bufcache.policy_lock);
+    return true;
+}
+
+/* Give the most recently added chunk back to the page allocator, provided
+   none of its entries is in use or dirty.  Returns true if it was freed.
+   The caller must hold chunks_lock. */
+static bool shrink(void)
+{
+    ASSERT(lock_held_by_current_thread(&bufcache.chunks_lock));
+    if (bufcache.num_entries < bufcache.min_entries + CHUNK_ENTRIES)
+        return false;
+    struct bufcache_chunk* chunk = list_entry(list_back(&bufcache.chunks), struct bufcache_chunk, elem);
+
+    for(int i = 0; i < NUM_STRIPES; i++)
+        lock_acquire(&bufcache.stripes[i].lock);
+    lock_acquire(&bufcache.policy_lock);
+    bool idle = true;
+    for(int i = 0; i < CHUNK_ENTRIES && idle; i++){
+        struct bufcache_entry* entry = &chunk->entries[i];
+        if (entry->hashed && (entry->pin_cnt > 0 || entry->dirty))
+            idle = false;
+    }
+    if (idle) {
+        for(int i = 0; i < CHUNK_ENTRIES; i++){
+            struct bufcache_entry* entry = &chunk->entries[i];
+            if (entry->hashed) {
+                hash_delete(&stripe_of(entry->sector)->index, &entry->hash_elem);
+                bufcache.policy->remove(&entry->policy_elem);
+            } else {
+                list_remove(&entry->policy_elem.elem);
+            }
+        }
+        list_remove(&chunk->elem);
+        bufcache.num_entries -= CHUNK_ENTRIES;
+        bufcache.policy->resize(bufcache.num_entries);
+    }
+    lock_release(&bufcache.policy_lock);
+    for(int i = NUM_STRIPES - 1; i >= 0; i--)
+        lock_release(&bufcache.stripes[i].lock);
+
+    if (idle) {
+        palloc_free_multiple(chunk->pages, CHUNK_PAGES);
+        free(chunk);
+    }
+    return idle;
+}
+
+/* Adapt the cache size to memory pressure: give a chunk back when the
+   kernel pool runs low, or add one if the cache had to evict while
+   memory is plentiful. */
+static void resize(void)
+{
+    size_t free_pages = palloc_free_count(0);
+    size_t pool_pages = palloc_pool_size(0);
+    unsigned evictions = bufcache.num_evictions;
+    bufcache.num_evictions = 0;
+
+    if (free_pages < pool_pages / LOW_FRACTION) {
+        writeback(0);
+        lock_acquire(&bufcache.chunks_lock);
+        shrink();
+        lock_release(&bufcache.chunks_lock);
+    } else if (evictions > 0 && free_pages > pool_pages / PLENTY_FRACTION) {
+        lock_acquire(&bufcache.chunks_lock);
+        if (bufcache.num_entries < bufcache.max_entries)
+            grow();
+        lock_release(&bufcache.chunks_lock);
+    }
+}
+
+/* Background write-behind thread.  Every FLUSH_PERIOD ticks, writes back
+   entries older than DIRTY_AGE; wakes up early and writes back everything
+   when too much of the cache is dirty, so that evictions rarely have to
+   clean their victim in the foreground.  Each pass first gives sectors to
+   the blocks inodes have held back for as long, so that their data is
+   written back in the same pass, then brings the free map file up to date
+   in the cache, so that the free map on disk lags the inodes and data by no
+   more than they lag the cache.  Also resizes the cache.  Exits once
+   bufcache_stop() asks it to. */
+static void flusher(void* aux UNUSED)
+{
+    for(;;){
+        int64_t start = timer_ticks();
+        while (timer_elapsed(start) < FLUSH_PERIOD && !bufcache.flush_requested
+               && !bufcache.stop_requested)
+            thread_yield();
+        if (bufcache.stop_requested)
+            break;
+
+        bool urgent = bufcache.flush_requested;
+        bufcache.flush_requested = false;
+        inode_flush(urgent ? 0 : DIRTY_AGE);
+        free_map_flush();
+        writeback(urgent ? 0 : DIRTY_AGE);
+        resize();
+    }
+    sema_up(&bufcache.flusher_stopped);
+}
+
+/* Stop the write-behind thread, waiting for a pass in progress to finish.
+   Called at shutdown, so that no pass runs while the file system is torn
+   down; bufcache_flush() still writes everything back. */
+void bufcache_stop(void)
+{
+    bufcache.stop_requested = true;
+    sema_down(&bufcache.flusher_stopped);
+}
+
+/* Ask for SECTOR to be read into the cache in the background.  Returns
+   immediately; the request is dropped if too many are already pending. */
+void bufcache_prefetch(block_sector_t sector)
+{
+    if (is_virtual(sector))
+        return;
+    lock_acquire(&bufcache.prefetch_lock);
+    if (bufcache.prefetch_cnt < PREFETCH_QUEUE_SIZE) {
+        size_t tail = (bufcache.prefetch_head + bufcache.prefetch_cnt) % PREFETCH_QUEUE_SIZE;
+        bufcache.prefetch_queue[tail] = sector;
+        bufcache.prefetch_cnt++;
+        cond_signal(&bufcache.prefetch_pending, &bufcache.prefetch_lock);
+    }
+    lock_release(&bufcache.prefetch_lock);
+}
+
+/* Give every held-back block its sector and write back the free map's
+   pending changes, then every dirty entry in one sweep across the disk. */
+void bufcache_flush(void)
+{
+    inode_flush(0);
+    free_map_flush();
+    writeback(0);
 }
 
 int bufcache_hit_count(void) {
@@ -197,13 +1041,30 @@ int bufcache_access_count(void) {
     return bufcache.num_accesses;
 }
 
+/* Drop every unused entry from the cache and reset the counters.
+   Dirty data is written back first so that nothing is lost. */
 void bufcache_reset(void) {
-    bufcache.num_ready = NUM_ENTRIES;
+    bufcache_flush();
+    lock_acquire(&bufcache.chunks_lock);
+    for(int i = 0; i < NUM_STRIPES; i++)
+        lock_acquire(&bufcache.stripes[i].lock);
+    lock_acquire(&bufcache.policy_lock);
     bufcache.num_hits = 0;
     bufcache.num_accesses = 0;
-    for(int i = 0; i < NUM_ENTRIES; i++){
-        bufcache.entries[i].dirty = false;
-        bufcache.entries[i].ready = true;
-        bufcache.entries[i].sector = INVALID_SECTOR;
+    for (struct list_elem* e = list_begin(&bufcache.chunks); e != list_end(&bufcache.chunks); e = list_next(e)) {
+        struct bufcache_chunk* chunk = list_entry(e, struct bufcache_chunk, elem);
+        for(int i = 0; i < CHUNK_ENTRIES; i++){
+            struct bufcache_entry* entry = &chunk->entries[i];
+            if (entry->hashed && entry->pin_cnt == 0 && !entry->dirty) {
+                hash_delete(&stripe_of(entry->sector)->index, &entry->hash_elem);
+                bufcache.policy->remove(&entry->policy_elem);
+                list_push_back(&bufcache.free_list, &entry->policy_elem.elem);
+                entry->hashed = false;
+            }
+        }
     }
+    lock_release(&bufcache.policy_lock);
+    for(int i = NUM_STRIPES - 1; i >= 0; i--)
+        lock_release(&bufcache.stripes[i].lock);
+    lock_release(&bufcache.chunks_lock);
 }
@@ -3,10 +3,28 @@
 
 #include "devices/block.h"
 
+/* Sectors from BUFCACHE_VIRTUAL_BASE up to 0x80000000 do not exist on
+   disk.  Data is cached under them, with bufcache_zero() or full-sector
+   bufcache_write(), until its owner gives it a real sector; meanwhile
+   it is neither written back nor evicted.  The owner drops it with
+   bufcache_discard(). */
+#define BUFCACHE_VIRTUAL_BASE 0x40000000u
+
 void bufcache_init(void); 
+void bufcache_set_size(size_t size);
+bool bufcache_select_policy(const char* name);
 void bufcache_read (block_sector_t sector, void* buffer, size_t offset, size_t length); 
 void bufcache_write(block_sector_t sector, const void* buffer, size_t offset, size_t length); 
+void bufcache_zero(block_sector_t sector);
+void* bufcache_get(block_sector_t sector, bool exclusive);
+void bufcache_mark_dirty(block_sector_t sector);
+void bufcache_put(block_sector_t sector);
+void bufcache_move(block_sector_t from, block_sector_t to);
+void bufcache_discard(block_sector_t sector);
+size_t bufcache_size(void);
+void bufcache_prefetch(block_sector_t sector);
 void bufcache_flush(void);
+void bufcache_stop(void);
 
 int bufcache_hit_count(void);
 int bufcache_access_count(void);
@@ -0,0 +1,171 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers what looking up a name in a directory found, so that
+   walking a path does not search each directory along the way
+   again.  An entry maps the sector of a directory's inode and a
+   name in it to the sector of the named file's inode, or to 0 if
+   the directory has no such name (sector 0 holds the free map, so
+   it is never a file).
+
+   The directory code keeps entries exact: it consults and fills
+   the cache only while holding the directory's lock, and replaces
+   the entry for a name it adds or removes.  A directory's entries
+   are purged when it is removed, and again when filesys_create()
+   gives its sector to a new directory, since lookups in a removed
+   directory that is still open can cache names under it.  The
+   least recently used entry is recycled when the cache is full. */
+
+/* Number of entries in the cache. */
+#define DCACHE_SIZE 256
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru or free_list. */
+    block_sector_t parent;              /* Sector of the directory. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t child;               /* Sector of the file, or 0. */
+  };
+
+static struct dentry entries[DCACHE_SIZE];
+static struct hash dentries;            /* Entries in use. */
+static struct list lru;                 /* Entries in use, least recent first. */
+static struct list free_list;           /* Entries not in use. */
+static struct lock dcache_lock;         /* Guards all of the above. */
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("Couldn't allocate the directory entry cache.");
+  list_init (&lru);
+  list_init (&free_list);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&free_list, &entries[i].lru_elem);
+  lock_init (&dcache_lock);
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer if there
+   is none.  The caller must hold dcache_lock. */
+static struct dentry *
+find (block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory whose inode is in sector PARENT.
+   If the cache knows the answer, returns true and sets *CHILD to
+   the sector of the file's inode, or to 0 if there is no such
+   file.  Otherwise, returns false. */
+bool
+dcache_lookup (block_sector_t parent, const char *name,
+               block_sector_t *child)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dcache_lock);
+  d = find (parent, name);
+  if (d != NULL)
+    {
+      *child = d->child;
+      list_remove (&d->lru_elem);
+      list_push_back (&lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME, in the directory whose inode is in sector
+   PARENT, names the file whose inode is in sector CHILD, or no
+   file if CHILD is 0. */
+void
+dcache_insert (block_sector_t parent, const char *name,
+               block_sector_t child)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (parent, name);
+  if (d == NULL)
+    {
+      if (list_empty (&free_list))
+        {
+          d = list_entry (list_pop_front (&lru), struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+        }
+      else
+        d = list_entry (list_pop_front (&free_list), struct dentry, lru_elem);
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+  d->child = child;
+  list_push_back (&lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name in the directory whose inode is in sector
+   PARENT. */
+void
+dcache_purge (block_sector_t parent)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->parent == parent)
+        {
+          hash_delete (&dentries, &d->hash_elem);
+          list_remove (&d->lru_elem);
+          list_push_back (&free_list, &d->lru_elem);
+        }
+    }
+  lock_release (&dcache_lock);
+}
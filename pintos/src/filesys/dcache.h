@@ -0,0 +1,14 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t parent, const char *name,
+                    block_sector_t *child);
+void dcache_insert (block_sector_t parent, const char *name,
+                    block_sector_t child);
+void dcache_purge (block_sector_t parent);
+
+#endif /* filesys/dcache.h */
@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
@@ -23,6 +26,80 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Hashed directory index.
+
+   Once a directory has INDEX_MIN_ENTRIES entries, it gets an index:
+   a separate file holding an open-addressing hash table that maps
+   the hash of each name in use to the number of its entry, so that
+   a lookup reads one sector of slots and the entry it points to.
+   Entry 0 of a directory names the parent and has no name of its
+   own, so an indexed directory keeps INDEX_MAGIC and the sector of
+   the index's inode in that entry's name.  Directories without an
+   index are searched linearly, as before, and are indexed the next
+   time an entry is added once they are large enough. */
+#define INDEX_MAGIC 0x58444e49          /* "INDX". */
+#define INDEX_MIN_ENTRIES 32
+
+/* A slot of the index. */
+struct index_slot
+  {
+    uint32_t hash;                      /* Hash of the name, or SLOT_*. */
+    uint32_t entry;                     /* Number of the directory entry. */
+  };
+#define SLOT_EMPTY 0                    /* Slot never used. */
+#define SLOT_DELETED 1                  /* Slot whose entry was removed. */
+#define SLOTS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct index_slot))
+
+/* Header of the index, in its first sector.  The slots follow. */
+struct index_header
+  {
+    uint32_t used;                      /* Slots that are not empty. */
+    uint32_t free_hint;                 /* No free entry comes before. */
+  };
+#define INDEX_SLOTS_OFS BLOCK_SECTOR_SIZE
+
+/* A probe through the slots of an index. */
+struct probe
+  {
+    struct inode *index;
+    size_t mask;                        /* Number of slots minus 1. */
+    size_t left;                        /* Slots not probed yet. */
+    size_t slot;                        /* Slot probed last. */
+    struct index_slot s;                /* Contents of SLOT. */
+  };
+
+/* Lookups and changes in a directory are serialized by the lock of
+   the stripe its sector falls in. */
+#define DIR_LOCK_CNT 16
+static struct lock dir_locks[DIR_LOCK_CNT];
+
+static block_sector_t index_get (const struct dir *);
+static bool index_set (struct dir *, block_sector_t);
+static struct inode *index_open (const struct dir *);
+static bool index_find (const struct dir *, struct inode *, const char *,
+                        struct dir_entry *, off_t *);
+static bool index_add (struct inode *, const char *, size_t entry);
+static void index_delete (struct inode *, const char *, size_t entry);
+static void index_build (struct dir *);
+static void index_destroy (block_sector_t);
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < DIR_LOCK_CNT; i++)
+    lock_init (&dir_locks[i]);
+}
+
+/* Returns the lock that serializes lookups and changes in DIR. */
+static struct lock *
+dir_lock (const struct dir *dir)
+{
+  return &dir_locks[inode_get_inumber (dir->inode) % DIR_LOCK_CNT];
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -33,6 +110,7 @@ dir_create (block_sector_t sector, size_t entry_cnt)
     {
       struct dir *curr_dir = dir_open (inode_open (sector));
       struct dir_entry e;
+      memset (&e, 0, sizeof e);
       e.inode_sector = sector;
       e.in_use = false;
 
@@ -108,11 +186,20 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp)
 {
   struct dir_entry e;
+  struct inode *index;
   size_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  index = index_open (dir);
+  if (index != NULL)
+    {
+      bool found = index_find (dir, index, name, ep, ofsp);
+      inode_close (index);
+      return found;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e)
     if (e.in_use && !strcmp (name, e.name))
@@ -145,10 +232,20 @@ dir_lookup (const struct dir *dir, const char *name,
     }
   else if (strcmp (name, ".") == 0)
     *inode = inode_reopen (dir->inode);
-  else if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
   else
-    *inode = NULL;
+    {
+      block_sector_t parent = inode_get_inumber (dir->inode);
+      block_sector_t sector;
+
+      lock_acquire (dir_lock (dir));
+      if (!dcache_lookup (parent, name, &sector))
+        {
+          sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+          dcache_insert (parent, name, sector);
+        }
+      *inode = sector != 0 ? inode_open (sector) : NULL;
+      lock_release (dir_lock (dir));
+    }
 
   return *inode != NULL;
 }
@@ -163,6 +260,8 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool isdir)
 {
   struct dir_entry e;
+  struct inode *index = NULL;
+  struct index_header h;
   off_t ofs;
   bool success = false;
 
@@ -173,11 +272,12 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  lock_acquire (dir_lock (dir));
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-
   if (isdir)
     {
       bool parent_success = true;
@@ -186,6 +286,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
       if (sub_dir == NULL)
         goto done;
 
+      memset (&e_, 0, sizeof e_);
       e_.in_use = false;
       e_.inode_sector = inode_get_inumber (dir_get_inode (dir));
       if (inode_write_at (sub_dir->inode, &e_, sizeof e_, 0) != sizeof e_)
@@ -197,15 +298,22 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
         goto done;
     }
 
-
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
+     In an indexed directory, start from the first entry that
+     may be free.
 
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = sizeof e; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  ofs = sizeof e;
+  index = index_open (dir);
+  if (index != NULL
+      && inode_read_at (index, &h, sizeof h, 0) == sizeof h
+      && h.free_hint > 1)
+    ofs = h.free_hint * sizeof e;
+  for (; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e)
     if (!e.in_use)
       break;
@@ -215,8 +323,27 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+
+  /* Bring the index up to date, or build one if the directory has
+     grown large enough. */
+  if (success && index != NULL)
+    {
+      if (!index_add (index, name, ofs / sizeof e))
+        index_build (dir);
+      else if (inode_read_at (index, &h, sizeof h, 0) == sizeof h)
+        {
+          h.free_hint = ofs / sizeof e + 1;
+          inode_write_at (index, &h, sizeof h, 0);
+        }
+    }
+  else if (success && ofs / sizeof e >= INDEX_MIN_ENTRIES)
+    index_build (dir);
 
  done:
+  inode_close (index);
+  lock_release (dir_lock (dir));
   return success;
 }
 
@@ -228,12 +355,14 @@ dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  struct inode *index = NULL;
   bool success = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (dir_lock (dir));
 
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
@@ -246,7 +375,7 @@ dir_remove (struct dir *dir, const char *name)
   
   if (inode_isdir(inode))
   {
-    struct dir *subdir_to_remove = dir_open(inode);
+    struct dir *subdir_to_remove = dir_open(inode_reopen(inode));
     struct dir_entry e_in_subdir;
 
     bool empty_dir = true;
@@ -258,6 +387,16 @@ dir_remove (struct dir *dir, const char *name)
       }
       ofs_remove += sizeof e_in_subdir;
     }
+    if (empty_dir)
+    {
+      /* Nothing is left to look up in it. */
+      dcache_purge(inode_get_inumber(inode));
+
+      /* An empty directory needs no index. */
+      block_sector_t subdir_index = index_get(subdir_to_remove);
+      if (subdir_index != 0 && index_set(subdir_to_remove, 0))
+        index_destroy(subdir_index);
+    }
     dir_close(subdir_to_remove);
     if (!empty_dir)
       goto done;
@@ -267,6 +406,22 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, 0);
+
+  /* Drop the entry from the index. */
+  index = index_open (dir);
+  if (index != NULL)
+    {
+      struct index_header h;
+      index_delete (index, name, ofs / sizeof e);
+      if (inode_read_at (index, &h, sizeof h, 0) == sizeof h
+          && h.free_hint > ofs / sizeof e)
+        {
+          h.free_hint = ofs / sizeof e;
+          inode_write_at (index, &h, sizeof h, 0);
+        }
+      inode_close (index);
+    }
 
   /* Remove inode. */
   inode_remove (inode);
@@ -274,6 +429,7 @@ dir_remove (struct dir *dir, const char *name)
 
  done:
   inode_close (inode);
+  lock_release (dir_lock (dir));
   return success;
 }
 
@@ -296,6 +452,238 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
   return false;
 }
 
+/* Returns the hash of NAME, as kept in an index slot. */
+static uint32_t
+name_hash (const char *name)
+{
+  uint32_t hash = hash_string (name);
+  return hash > SLOT_DELETED ? hash : hash + 2;
+}
+
+/* Returns the sector of the inode of DIR's index, or 0 if DIR has
+   none. */
+static block_sector_t
+index_get (const struct dir *dir)
+{
+  struct dir_entry e;
+  uint32_t magic;
+  block_sector_t sector;
+
+  if (inode_read_at (dir->inode, &e, sizeof e, 0) != sizeof e)
+    return 0;
+  memcpy (&magic, e.name, sizeof magic);
+  memcpy (&sector, e.name + sizeof magic, sizeof sector);
+  return magic == INDEX_MAGIC ? sector : 0;
+}
+
+/* Records SECTOR as the sector of the inode of DIR's index, or
+   that DIR has no index if SECTOR is 0.  Returns true if
+   successful, false on failure. */
+static bool
+index_set (struct dir *dir, block_sector_t sector)
+{
+  struct dir_entry e;
+  uint32_t magic = sector != 0 ? INDEX_MAGIC : 0;
+
+  if (inode_read_at (dir->inode, &e, sizeof e, 0) != sizeof e)
+    return false;
+  memcpy (e.name, &magic, sizeof magic);
+  memcpy (e.name + sizeof magic, &sector, sizeof sector);
+  return inode_write_at (dir->inode, &e, sizeof e, 0) == sizeof e;
+}
+
+/* Opens and returns DIR's index, or a null pointer if DIR has
+   none. */
+static struct inode *
+index_open (const struct dir *dir)
+{
+  block_sector_t sector = index_get (dir);
+  return sector != 0 ? inode_open (sector) : NULL;
+}
+
+/* Starts P probing INDEX for HASH. */
+static void
+probe_init (struct probe *p, struct inode *index, uint32_t hash)
+{
+  size_t slot_cnt = ((inode_length (index) - INDEX_SLOTS_OFS)
+                     / sizeof (struct index_slot));
+
+  p->index = index;
+  p->mask = slot_cnt - 1;
+  p->left = slot_cnt;
+  p->slot = (hash + p->mask) & p->mask;
+}
+
+/* Reads the next slot in P's probe sequence into P->S.  Returns
+   false if every slot has been probed, or on failure. */
+static bool
+probe_next (struct probe *p)
+{
+  if (p->left == 0)
+    return false;
+  p->left--;
+  p->slot = (p->slot + 1) & p->mask;
+  return (inode_read_at (p->index, &p->s, sizeof p->s,
+                         INDEX_SLOTS_OFS + p->slot * sizeof p->s)
+          == sizeof p->s);
+}
+
+/* Stores HASH and ENTRY in the slot P probed last.  Returns true if
+   successful, false on failure. */
+static bool
+probe_write (struct probe *p, uint32_t hash, uint32_t entry)
+{
+  p->s.hash = hash;
+  p->s.entry = entry;
+  return (inode_write_at (p->index, &p->s, sizeof p->s,
+                          INDEX_SLOTS_OFS + p->slot * sizeof p->s)
+          == sizeof p->s);
+}
+
+/* Searches INDEX of DIR for NAME, as lookup() does. */
+static bool
+index_find (const struct dir *dir, struct inode *index, const char *name,
+            struct dir_entry *ep, off_t *ofsp)
+{
+  uint32_t hash = name_hash (name);
+  struct probe p;
+
+  probe_init (&p, index, hash);
+  while (probe_next (&p) && p.s.hash != SLOT_EMPTY)
+    if (p.s.hash == hash)
+      {
+        struct dir_entry e;
+        off_t ofs = p.s.entry * sizeof e;
+
+        if (inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+            && e.in_use && !strcmp (name, e.name))
+          {
+            if (ep != NULL)
+              *ep = e;
+            if (ofsp != NULL)
+              *ofsp = ofs;
+            return true;
+          }
+      }
+  return false;
+}
+
+/* Adds NAME, in directory entry number ENTRY, to INDEX.  Returns
+   false if INDEX would be more than 3/4 full, or on failure; the
+   index must then be rebuilt. */
+static bool
+index_add (struct inode *index, const char *name, size_t entry)
+{
+  uint32_t hash = name_hash (name);
+  struct index_header h;
+  struct probe p;
+
+  if (inode_read_at (index, &h, sizeof h, 0) != sizeof h)
+    return false;
+
+  probe_init (&p, index, hash);
+  if ((h.used + 1) * 4 > (p.mask + 1) * 3)
+    return false;
+  while (probe_next (&p))
+    if (p.s.hash == SLOT_EMPTY || p.s.hash == SLOT_DELETED)
+      {
+        if (p.s.hash == SLOT_EMPTY)
+          {
+            h.used++;
+            if (inode_write_at (index, &h, sizeof h, 0) != sizeof h)
+              return false;
+          }
+        return probe_write (&p, hash, entry);
+      }
+  return false;
+}
+
+/* Removes NAME, in directory entry number ENTRY, from INDEX. */
+static void
+index_delete (struct inode *index, const char *name, size_t entry)
+{
+  uint32_t hash = name_hash (name);
+  struct probe p;
+
+  probe_init (&p, index, hash);
+  while (probe_next (&p) && p.s.hash != SLOT_EMPTY)
+    if (p.s.hash == hash && p.s.entry == entry)
+      {
+        probe_write (&p, SLOT_DELETED, entry);
+        return;
+      }
+}
+
+/* Gives DIR a new index of the entries in use, sized to be at most
+   half full, in place of the one it has, if any.  On failure, DIR
+   is left without an index and is searched linearly. */
+static void
+index_build (struct dir *dir)
+{
+  block_sector_t old = index_get (dir);
+  block_sector_t sector = 0;
+  struct inode *index = NULL;
+  struct index_header h;
+  struct dir_entry e;
+  size_t entry, live = 0, slot_cnt = SLOTS_PER_SECTOR;
+  bool success;
+
+  h.used = 0;
+  h.free_hint = 0;
+  for (entry = 1; inode_read_at (dir->inode, &e, sizeof e,
+                                 entry * sizeof e) == sizeof e; entry++)
+    if (e.in_use)
+      live++;
+    else if (h.free_hint == 0)
+      h.free_hint = entry;
+  if (h.free_hint == 0)
+    h.free_hint = entry;
+  while (slot_cnt < 2 * (live + 1))
+    slot_cnt *= 2;
+
+  success = (free_map_allocate_near (inode_get_inumber (dir->inode) + 1,
+                                     1, &sector)
+             && inode_create (sector, (INDEX_SLOTS_OFS
+                                       + slot_cnt * sizeof (struct index_slot)),
+                              false)
+             && (index = inode_open (sector)) != NULL
+             && inode_write_at (index, &h, sizeof h, 0) == sizeof h);
+  for (entry = 1; success && inode_read_at (dir->inode, &e, sizeof e,
+                                            entry * sizeof e) == sizeof e;
+       entry++)
+    if (e.in_use)
+      success = index_add (index, e.name, entry);
+  success = success && index_set (dir, sector);
+
+  if (!success)
+    {
+      if (index != NULL)
+        inode_remove (index);
+      else if (sector != 0)
+        free_map_release (sector, 1);
+      if (old != 0)
+        index_set (dir, 0);
+    }
+  inode_close (index);
+  index_destroy (old);
+}
+
+/* Deletes the index whose inode is in SECTOR, if SECTOR is not 0. */
+static void
+index_destroy (block_sector_t sector)
+{
+  struct inode *index;
+
+  if (sector == 0)
+    return;
+  index = inode_open (sector);
+  if (index != NULL)
+    {
+      inode_remove (index);
+      inode_close (index);
+    }
+}
+
 /* Proj 3 Task 3 */
 static int get_next_part (char part[NAME_MAX + 1], const char **srcp)
 {
@@ -0,0 +1,621 @@
+#include "filesys/extent.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/bufcache.h"
+#include "filesys/free-map.h"
+
+/* Extent trees.
+
+   The extents of a file are kept sorted by file block in a B+-tree
+   whose root lives in the inode.  Index nodes hold one entry per
+   child, keyed by the lowest file block mapped under that child;
+   leaves hold the extents themselves.  Every node but the root
+   takes one sector.  Blocks that no extent covers are holes.
+
+   The tree only grows: extents are added to fill holes, and split
+   when part of an unwritten extent is written, but whole files are
+   freed at once.  All functions must be called with the inode's lock held;
+   they change the root in place, and the caller writes the inode
+   back. */
+
+/* A node of an extent tree other than the root.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+#define EXTENT_NODE_CNT 42
+struct extent_node
+  {
+    struct extent_header hdr;
+    struct extent entries[EXTENT_NODE_CNT];
+    uint8_t unused[4];
+  };
+
+/* A node being worked on: either the root, or a node pinned in the
+   buffer cache. */
+struct node_ref
+  {
+    struct extent_header *hdr;
+    struct extent *entries;
+    size_t max_cnt;             /* Capacity of ENTRIES. */
+    bool is_root;
+    block_sector_t sector;      /* Sector of the node, unless IS_ROOT. */
+  };
+
+/* Makes REF refer to ROOT. */
+static void
+ref_root (struct node_ref *ref, struct extent_root *root)
+{
+  ref->hdr = &root->hdr;
+  ref->entries = root->entries;
+  ref->max_cnt = EXTENT_ROOT_CNT;
+  ref->is_root = true;
+}
+
+/* Pins the node in SECTOR, for modification if EXCLUSIVE, and
+   makes REF refer to it. */
+static void
+ref_get (struct node_ref *ref, block_sector_t sector, bool exclusive)
+{
+  struct extent_node *node = bufcache_get (sector, exclusive);
+  ref->hdr = &node->hdr;
+  ref->entries = node->entries;
+  ref->max_cnt = EXTENT_NODE_CNT;
+  ref->is_root = false;
+  ref->sector = sector;
+}
+
+/* Releases the node REF refers to. */
+static void
+ref_put (struct node_ref *ref)
+{
+  if (!ref->is_root)
+    bufcache_put (ref->sector);
+}
+
+/* Records that the node REF refers to was modified. */
+static void
+ref_dirty (struct node_ref *ref)
+{
+  if (!ref->is_root)
+    bufcache_mark_dirty (ref->sector);
+}
+
+/* Most nodes one insertion can need, for a tree of the greatest
+   depth that 2**32 blocks allow, counting a second insertion after
+   the root grows. */
+#define NODE_SPARE_MAX 16
+
+/* Where the new nodes of one change to a tree come from: sectors
+   allocated ahead of time, then the free map, from GOAL on. */
+struct node_alloc
+  {
+    block_sector_t goal;        /* Near the data the nodes map. */
+    block_sector_t spare[NODE_SPARE_MAX];
+    size_t spare_cnt;
+  };
+
+/* Initializes NA to allocate nodes near GOAL, with no spares. */
+static void
+node_alloc_init (struct node_alloc *na, block_sector_t goal)
+{
+  na->goal = goal;
+  na->spare_cnt = 0;
+}
+
+/* Allocates CNT spare nodes for NA.  Returns false, keeping none,
+   if the disk is full. */
+static bool
+node_alloc_reserve (struct node_alloc *na, size_t cnt)
+{
+  ASSERT (na->spare_cnt + cnt <= NODE_SPARE_MAX);
+  while (cnt-- > 0)
+    {
+      block_sector_t *sector = &na->spare[na->spare_cnt];
+      if (!free_map_allocate_near (na->goal, 1, sector))
+        {
+          while (na->spare_cnt > 0)
+            free_map_release (na->spare[--na->spare_cnt], 1);
+          return false;
+        }
+      na->goal = *sector + 1;
+      na->spare_cnt++;
+    }
+  return true;
+}
+
+/* Releases the spare nodes NA did not use. */
+static void
+node_alloc_done (struct node_alloc *na)
+{
+  while (na->spare_cnt > 0)
+    free_map_release (na->spare[--na->spare_cnt], 1);
+}
+
+/* Allocates an empty node at depth DEPTH through NA, stores its
+   sector in *SECTOR and makes REF refer to it, pinned exclusively.
+   Returns false if the disk is full. */
+static bool
+new_node (struct node_alloc *na, block_sector_t *sector,
+          struct node_ref *ref, uint16_t depth)
+{
+  if (na->spare_cnt > 0)
+    *sector = na->spare[--na->spare_cnt];
+  else if (!free_map_allocate_near (na->goal, 1, sector))
+    return false;
+  bufcache_zero (*sector);
+  ref_get (ref, *sector, true);
+  ref->hdr->depth = depth;
+  return true;
+}
+
+/* Returns the index of the last of the CNT ENTRIES whose file
+   block is at most BLOCK, or -1 if there is none. */
+static int
+find_slot (const struct extent *entries, size_t cnt, uint32_t block)
+{
+  int lo = 0, hi = cnt;
+
+  /* Invariant: entries below LO are at most BLOCK, from HI on above. */
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (entries[mid].file_block <= block)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo - 1;
+}
+
+/* Inserts E at position POS of the node REF refers to, which must
+   have room for it. */
+static void
+insert_entry (struct node_ref *ref, size_t pos, const struct extent *e)
+{
+  ASSERT (ref->hdr->cnt < ref->max_cnt);
+  ASSERT (pos <= ref->hdr->cnt);
+  memmove (&ref->entries[pos + 1], &ref->entries[pos],
+           (ref->hdr->cnt - pos) * sizeof *e);
+  ref->entries[pos] = *e;
+  ref->hdr->cnt++;
+  ref_dirty (ref);
+}
+
+/* Removes the entry at position POS of the node REF refers to. */
+static void
+remove_entry (struct node_ref *ref, size_t pos)
+{
+  ASSERT (pos < ref->hdr->cnt);
+  ref->hdr->cnt--;
+  memmove (&ref->entries[pos], &ref->entries[pos + 1],
+           (ref->hdr->cnt - pos) * sizeof *ref->entries);
+  ref_dirty (ref);
+}
+
+/* Moves all the entries of the root REF refers to into a new node,
+   allocated through NA, which becomes the root's only child, and
+   makes CHILD refer to it.  Returns false if the disk is full. */
+static bool
+grow_root (struct node_ref *ref, struct node_ref *child,
+           struct node_alloc *na)
+{
+  block_sector_t sector;
+
+  ASSERT (ref->is_root);
+  if (!new_node (na, &sector, child, ref->hdr->depth))
+    return false;
+  memcpy (child->entries, ref->entries, ref->hdr->cnt * sizeof *ref->entries);
+  child->hdr->cnt = ref->hdr->cnt;
+  ref_dirty (child);
+
+  ref->entries[0].file_block = ref->hdr->cnt > 0 ? ref->entries[0].file_block : 0;
+  ref->entries[0].start = sector;
+  ref->entries[0].length = 0;
+  ref->hdr->cnt = 1;
+  ref->hdr->depth++;
+  return true;
+}
+
+/* Inserts E at position POS of the node REF refers to.  If the node
+   is full, it is split: its upper half moves to a new node, and
+   *SPLIT is set to the index entry for the new node, which the
+   caller must insert into the parent.  A full root instead moves
+   its entries one level down.  New nodes come from NA.  Returns
+   false if the disk is full. */
+static bool
+insert_at (struct node_ref *ref, size_t pos, const struct extent *e,
+           struct extent *split, bool *did_split, struct node_alloc *na)
+{
+  struct node_ref sibling;
+  block_sector_t sector;
+  size_t half;
+
+  *did_split = false;
+  if (ref->hdr->cnt < ref->max_cnt)
+    {
+      insert_entry (ref, pos, e);
+      return true;
+    }
+
+  if (ref->is_root)
+    {
+      if (!grow_root (ref, &sibling, na))
+        return false;
+      insert_entry (&sibling, pos, e);
+      ref->entries[0].file_block = sibling.entries[0].file_block;
+      ref_put (&sibling);
+      return true;
+    }
+
+  if (!new_node (na, &sector, &sibling, ref->hdr->depth))
+    return false;
+  half = ref->hdr->cnt / 2;
+  memcpy (sibling.entries, &ref->entries[half],
+          (ref->hdr->cnt - half) * sizeof *ref->entries);
+  sibling.hdr->cnt = ref->hdr->cnt - half;
+  ref->hdr->cnt = half;
+  ref_dirty (ref);
+  ref_dirty (&sibling);
+  if (pos <= half)
+    insert_entry (ref, pos, e);
+  else
+    insert_entry (&sibling, pos - half, e);
+
+  split->file_block = sibling.entries[0].file_block;
+  split->start = sector;
+  split->length = 0;
+  *did_split = true;
+  ref_put (&sibling);
+  return true;
+}
+
+/* Inserts extent E into the subtree under the node REF refers to,
+   which is pinned exclusively.  Sets *SPLIT and *DID_SPLIT and
+   allocates nodes through NA as insert_at() does.  Returns false if
+   the disk is full. */
+static bool
+insert_rec (struct node_ref *ref, const struct extent *e,
+            struct extent *split, bool *did_split, struct node_alloc *na)
+{
+  int slot = find_slot (ref->entries, ref->hdr->cnt, e->file_block);
+  struct extent pending = *e;
+
+  if (ref->hdr->depth > 0)
+    {
+      struct node_ref child;
+      bool child_split, success;
+
+      /* E goes below everything else: lower the first key. */
+      if (slot < 0)
+        {
+          slot = 0;
+          ref->entries[0].file_block = e->file_block;
+          ref_dirty (ref);
+        }
+
+      ref_get (&child, ref->entries[slot].start, true);
+      success = insert_rec (&child, e, &pending, &child_split, na);
+      ref_put (&child);
+      if (!success || !child_split)
+        {
+          *did_split = false;
+          return success;
+        }
+    }
+  return insert_at (ref, slot + 1, &pending, split, did_split, na);
+}
+
+/* Inserts extent E into the tree under ROOT, allocating new nodes
+   through NA.  Returns false if the disk is full. */
+static bool
+insert_with (struct extent_root *root, const struct extent *e,
+             struct node_alloc *na)
+{
+  struct node_ref ref;
+  struct extent split;
+  bool did_split;
+
+  ref_root (&ref, root);
+  if (!insert_rec (&ref, e, &split, &did_split, na))
+    return false;
+  ASSERT (!did_split);
+  return true;
+}
+
+/* Inserts extent E into the tree under ROOT, placing new nodes near
+   E's sectors.  Returns false if the disk is full. */
+static bool
+extent_insert (struct extent_root *root, const struct extent *e)
+{
+  struct node_alloc na;
+
+  node_alloc_init (&na, e->start);
+  return insert_with (root, e, &na);
+}
+
+/* Initializes ROOT as an empty tree. */
+void
+extent_init (struct extent_root *root)
+{
+  memset (root, 0, sizeof *root);
+}
+
+/* Looks up the extent under ROOT that contains file block BLOCK and
+   copies it into *FOUND.  Returns false if BLOCK is in a hole, and
+   then sets *NEXT, if non-null, to the first mapped block past it,
+   or UINT32_MAX if there is none. */
+static bool
+lookup (const struct extent_root *root, uint32_t block,
+        struct extent *found, uint32_t *next)
+{
+  struct node_ref ref;
+  uint32_t bound = UINT32_MAX;
+  bool success = false;
+  int slot;
+
+  ref_root (&ref, (struct extent_root *) root);
+  for (;;)
+    {
+      slot = find_slot (ref.entries, ref.hdr->cnt, block);
+      if (slot + 1 < ref.hdr->cnt)
+        bound = ref.entries[slot + 1].file_block;
+      if (ref.hdr->depth == 0 || slot < 0)
+        break;
+      block_sector_t child = ref.entries[slot].start;
+      ref_put (&ref);
+      ref_get (&ref, child, false);
+    }
+
+  if (ref.hdr->depth == 0 && slot >= 0
+      && block - ref.entries[slot].file_block < extent_length (&ref.entries[slot]))
+    {
+      *found = ref.entries[slot];
+      success = true;
+    }
+  else if (next != NULL)
+    *next = bound;
+  ref_put (&ref);
+  return success;
+}
+
+/* Looks up the extent under ROOT that contains file block BLOCK and
+   copies it into *FOUND.  Returns false if BLOCK is in a hole. */
+bool
+extent_find (const struct extent_root *root, uint32_t block,
+             struct extent *found)
+{
+  return lookup (root, block, found, NULL);
+}
+
+/* Extends the extent under ROOT that maps the block just before E,
+   if E follows it both in the file and on disk and both were
+   written, or neither.  Returns true if successful. */
+static bool
+extend_prev (struct extent_root *root, const struct extent *e)
+{
+  struct node_ref ref;
+  bool success = false;
+  uint32_t block = e->file_block - 1;
+  int slot;
+
+  if (e->file_block == 0)
+    return false;
+
+  ref_root (&ref, root);
+  for (;;)
+    {
+      slot = find_slot (ref.entries, ref.hdr->cnt, block);
+      if (ref.hdr->depth == 0 || slot < 0)
+        break;
+      block_sector_t child = ref.entries[slot].start;
+      ref_put (&ref);
+      ref_get (&ref, child, true);
+    }
+  if (ref.hdr->depth == 0 && slot >= 0)
+    {
+      struct extent *prev = &ref.entries[slot];
+      uint32_t length = extent_length (prev);
+      if (extent_unwritten (prev) == extent_unwritten (e)
+          && prev->file_block + length == e->file_block
+          && prev->start + length == e->start)
+        {
+          prev->length += extent_length (e);
+          ref_dirty (&ref);
+          success = true;
+        }
+    }
+  ref_put (&ref);
+  return success;
+}
+
+/* Maps the file blocks FIRST up to END under ROOT that are holes to
+   unwritten extents, as long as the free map allows.  Their sectors
+   are looked for from GOAL on, or after the extent before them.
+   Returns false if the disk is full. */
+bool
+extent_allocate (struct extent_root *root, uint32_t first, uint32_t end,
+                 block_sector_t goal)
+{
+  uint32_t block = first;
+
+  while (block < end)
+    {
+      struct extent e;
+      uint32_t next;
+      size_t cnt;
+
+      /* Skip blocks already mapped. */
+      if (lookup (root, block, &e, &next))
+        {
+          block = e.file_block + extent_length (&e);
+          goal = e.start + extent_length (&e);
+          continue;
+        }
+      cnt = (next < end ? next : end) - block;
+
+      /* Take the longest run we can get, halving on failure. */
+      while (!free_map_allocate_near (goal, cnt, &e.start))
+        {
+          if (cnt == 1)
+            return false;
+          cnt /= 2;
+        }
+      e.file_block = block;
+      e.length = cnt | EXTENT_UNWRITTEN;
+      if (!extend_prev (root, &e) && !extent_insert (root, &e))
+        {
+          free_map_release (e.start, cnt);
+          return false;
+        }
+      block += cnt;
+      goal = e.start + cnt;
+    }
+  return true;
+}
+
+/* Maps the CNT file blocks from FIRST on under ROOT, which must be
+   holes, to the written sectors from START on.  Returns false if the
+   disk is too full to grow the tree. */
+bool
+extent_map (struct extent_root *root, uint32_t first, block_sector_t start,
+            uint32_t cnt)
+{
+  struct extent e = {first, start, cnt};
+
+  ASSERT (cnt > 0 && cnt < EXTENT_UNWRITTEN);
+  return extend_prev (root, &e) || extent_insert (root, &e);
+}
+
+/* Marks file block BLOCK under ROOT as written, splitting its
+   unwritten extent as needed, and returns its sector.  Returns
+   (block_sector_t) -1 if the disk is too full to split the extent
+   or BLOCK is in a hole. */
+block_sector_t
+extent_materialize (struct extent_root *root, uint32_t block)
+{
+  struct extent rest[2];
+  size_t rest_cnt = 0;
+  struct node_alloc na;
+  struct node_ref ref;
+  struct extent *e;
+  block_sector_t sector;
+  uint32_t length, ofs;
+  int slot;
+  size_t i;
+
+  /* Find the leaf.  Only the leaf changes, so parents need not stay
+     pinned. */
+  ref_root (&ref, root);
+  for (;;)
+    {
+      slot = find_slot (ref.entries, ref.hdr->cnt, block);
+      if (ref.hdr->depth == 0 || slot < 0)
+        break;
+      block_sector_t child = ref.entries[slot].start;
+      ref_put (&ref);
+      ref_get (&ref, child, true);
+    }
+  if (ref.hdr->depth > 0 || slot < 0
+      || block - ref.entries[slot].file_block >= extent_length (&ref.entries[slot]))
+    {
+      ref_put (&ref);
+      return -1;
+    }
+
+  e = &ref.entries[slot];
+  length = extent_length (e);
+  ofs = block - e->file_block;
+  sector = e->start + ofs;
+  if (!extent_unwritten (e))
+    {
+      ref_put (&ref);
+      return sector;
+    }
+
+  if (ofs == 0 && slot > 0 && !extent_unwritten (e - 1)
+      && e[-1].file_block + e[-1].length == block
+      && e[-1].start + e[-1].length == sector)
+    {
+      /* Sequential writes: move the block over to the written
+         extent that precedes it. */
+      e[-1].length++;
+      e->file_block++;
+      e->start++;
+      e->length--;
+      if (extent_length (e) == 0)
+        remove_entry (&ref, slot);
+    }
+  else if (length == 1)
+    e->length = 1;
+  else
+    {
+      /* Splitting adds the pieces in REST to this leaf.  If it has
+         no room for them, set aside every node the insertions could
+         need before changing anything, so that they cannot fail
+         halfway and leave sectors unmapped.  Each insertion can
+         split every node on its path and grow the root. */
+      if (ofs == 0)
+        rest[rest_cnt++] = (struct extent) {block + 1, sector + 1,
+                                            (length - 1) | EXTENT_UNWRITTEN};
+      else
+        {
+          rest[rest_cnt++] = (struct extent) {block, sector, 1};
+          if (ofs + 1 < length)
+            rest[rest_cnt++] = (struct extent) {block + 1, sector + 1,
+                                                (length - ofs - 1) | EXTENT_UNWRITTEN};
+        }
+      node_alloc_init (&na, sector);
+      if (ref.hdr->cnt + rest_cnt > ref.max_cnt
+          && !node_alloc_reserve (&na, (rest_cnt * (root->hdr.depth + 1)
+                                        + rest_cnt - 1)))
+        {
+          ref_put (&ref);
+          return -1;
+        }
+      e->length = ofs == 0 ? 1 : ofs | EXTENT_UNWRITTEN;
+    }
+  ref_dirty (&ref);
+  ref_put (&ref);
+
+  if (rest_cnt > 0)
+    {
+      for (i = 0; i < rest_cnt; i++)
+        if (!insert_with (root, &rest[i], &na))
+          NOT_REACHED ();
+      node_alloc_done (&na);
+    }
+  return sector;
+}
+
+/* Releases the blocks mapped under the node REF refers to, and the
+   nodes below it. */
+static void
+free_subtree (struct node_ref *ref)
+{
+  size_t i;
+
+  for (i = 0; i < ref->hdr->cnt; i++)
+    {
+      struct extent *e = &ref->entries[i];
+      if (ref->hdr->depth > 0)
+        {
+          struct node_ref child;
+          ref_get (&child, e->start, false);
+          free_subtree (&child);
+          ref_put (&child);
+          free_map_release (e->start, 1);
+        }
+      else
+        free_map_release (e->start, extent_length (e));
+    }
+}
+
+/* Releases every block mapped under ROOT and every node of the
+   tree, leaving ROOT empty. */
+void
+extent_free (struct extent_root *root)
+{
+  struct node_ref ref;
+
+  ref_root (&ref, root);
+  free_subtree (&ref);
+  extent_init (root);
+}
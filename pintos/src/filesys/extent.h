@@ -0,0 +1,62 @@
+#ifndef FILESYS_EXTENT_H
+#define FILESYS_EXTENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/block.h"
+
+/* A run of LENGTH data blocks of a file, starting at block
+   FILE_BLOCK within the file and at sector START on disk.  In the
+   index nodes of an extent tree, START is instead the sector of a
+   child node that maps the blocks from FILE_BLOCK on, and LENGTH
+   is unused. */
+struct extent
+  {
+    uint32_t file_block;        /* First block within the file. */
+    block_sector_t start;       /* First sector on disk. */
+    uint32_t length;            /* Number of blocks, maybe EXTENT_UNWRITTEN. */
+  };
+
+/* Set in the length of an extent whose blocks were allocated but
+   never written.  They read as zeros. */
+#define EXTENT_UNWRITTEN 0x80000000u
+
+/* Header of every node of an extent tree. */
+struct extent_header
+  {
+    uint16_t cnt;               /* Number of entries in use. */
+    uint16_t depth;             /* 0 if the entries are extents. */
+  };
+
+/* Root of an extent tree, kept inside the on-disk inode. */
+#define EXTENT_ROOT_CNT 41
+struct extent_root
+  {
+    struct extent_header hdr;
+    struct extent entries[EXTENT_ROOT_CNT];
+  };
+
+/* Returns the number of blocks in extent E. */
+static inline uint32_t
+extent_length (const struct extent *e)
+{
+  return e->length & ~EXTENT_UNWRITTEN;
+}
+
+/* Returns true if the blocks of extent E were never written. */
+static inline bool
+extent_unwritten (const struct extent *e)
+{
+  return (e->length & EXTENT_UNWRITTEN) != 0;
+}
+
+void extent_init (struct extent_root *);
+bool extent_find (const struct extent_root *, uint32_t block, struct extent *);
+bool extent_allocate (struct extent_root *, uint32_t first, uint32_t end,
+                      block_sector_t goal);
+bool extent_map (struct extent_root *, uint32_t first, block_sector_t start,
+                 uint32_t cnt);
+block_sector_t extent_materialize (struct extent_root *, uint32_t block);
+void extent_free (struct extent_root *);
+
+#endif /* filesys/extent.h */
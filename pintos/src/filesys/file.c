@@ -9,6 +9,7 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    struct inode_readahead ra;  /* Sequential read-ahead state. */
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -23,6 +24,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      inode_readahead_init (&file->ra);
       return file;
     }
   else
@@ -68,7 +70,8 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = inode_read_ahead_at (file->inode, buffer, size,
+                                         file->pos, &file->ra);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -82,7 +85,7 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  return inode_read_ahead_at (file->inode, buffer, size, file_ofs, &file->ra);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -114,6 +117,17 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Allocates space for the LENGTH bytes of FILE starting at offset
+   START in the file, extending FILE if need be, without writing them.
+   They read as zeros.  FILE's current position is unaffected.
+   Returns true if successful, false if LENGTH is not positive, or if
+   writes to FILE are denied or the disk is full. */
+bool
+file_allocate (struct file *file, off_t start, off_t length)
+{
+  return inode_fallocate (file->inode, start, length);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
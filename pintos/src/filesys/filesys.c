@@ -5,6 +5,7 @@
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/dcache.h"
 #include "filesys/directory.h"
 #include "filesys/bufcache.h"
 
@@ -24,10 +25,19 @@ filesys_init (bool format)
 
   inode_init ();
   free_map_init ();
+  dir_init ();
+  dcache_init ();
   bufcache_init();
 
   if (format)
     do_format ();
+  else
+    {
+      /* Create files in the format the disk was formatted with. */
+      struct inode *inode = inode_open (FREE_MAP_SECTOR);
+      inode_set_format (inode_get_format (inode));
+      inode_close (inode);
+    }
 
   free_map_open ();
 }
@@ -37,7 +47,8 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
-  bufcache_flush();
+  bufcache_stop ();
+  bufcache_flush ();
   free_map_close ();
 }
 
@@ -57,10 +68,23 @@ filesys_create (const char *name, off_t initial_size, bool isdir)
   bool split_success = split_directory_and_filename (name, directory, filename);
   struct dir *dir = dir_open_directory (directory);
 
+  /* Put a file next to its directory, and a directory where there
+     is room for its own files. */
+  block_sector_t goal = 0;
+  if (dir != NULL)
+    goal = isdir ? free_map_spread_goal ()
+                 : inode_get_inumber (dir_get_inode (dir)) + 1;
+
   bool success = (split_success && dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, isdir)
-                  && dir_add (dir, filename, inode_sector, isdir));
+                  && free_map_allocate_near (goal, 1, &inode_sector));
+
+  /* Forget the names cached for a directory that had the sector. */
+  if (success && isdir)
+    dcache_purge (inode_sector);
+
+  success = (success
+             && inode_create (inode_sector, initial_size, isdir)
+             && dir_add (dir, filename, inode_sector, isdir));
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
@@ -1,70 +1,391 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
-static struct file *free_map_file;   /* Free map file. */
+static struct file *free_map_file;   /* Free map file, or null while it
+                                        is closed. */
+static struct lock file_lock;        /* Guards free_map_file, and writing
+                                        it out. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock count_lock;       /* Guards the two counts below. */
+static size_t free_cnt;              /* Number of free sectors. */
+static size_t reserved_cnt;          /* Free sectors promised to callers. */
+static struct bitmap *dirty_map;     /* Free map file sectors not yet
+                                        written, one bit per sector. */
+
+/* Bits of the free map held by each sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* The disk is divided into block groups of GROUP_SECTORS sectors.
+   Allocations start looking at a goal sector, so that the blocks of
+   a file end up next to each other and near its inode, and files
+   near their directory; new directories go to the emptiest group.
+
+   Each group has its own lock, so that threads allocating from
+   different groups do not wait for each other, and a run of sectors
+   never spans two groups. */
+#define GROUP_SECTORS 1024
+
+/* A block group. */
+struct group
+  {
+    struct lock lock;                /* Guards the group's bits and count. */
+    size_t free_cnt;                 /* Free sectors in the group. */
+  };
+static size_t group_cnt;             /* Number of block groups. */
+static struct group *groups;         /* Block groups. */
+
+/* Returns the sector just past the end of group G. */
+static block_sector_t
+group_end (size_t g)
+{
+  block_sector_t end = (g + 1) * GROUP_SECTORS;
+  return end < bitmap_size (free_map) ? end : bitmap_size (free_map);
+}
+
+/* Recounts the free sectors of every block group. */
+static void
+count_groups (void)
+{
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    groups[g].free_cnt = bitmap_count (free_map, g * GROUP_SECTORS,
+                                       group_end (g) - g * GROUP_SECTORS,
+                                       false);
+}
+
+/* Takes CNT free sectors out of the free count.  They come out of
+   the reserved sectors the running thread has claimed, if it has
+   claimed that many, and *RESERVED is set to true.  Otherwise, this
+   fails if it would leave fewer free sectors than are reserved.
+   Returns true if successful. */
+static bool
+take_free (size_t cnt, bool *reserved)
+{
+  struct thread *t = thread_current ();
+  bool success = true;
+
+  lock_acquire (&count_lock);
+  *reserved = cnt <= t->alloc_reserved;
+  if (*reserved)
+    {
+      t->alloc_reserved -= cnt;
+      reserved_cnt -= cnt;
+    }
+  else
+    success = cnt <= free_cnt - reserved_cnt;
+  if (success)
+    free_cnt -= cnt;
+  lock_release (&count_lock);
+  return success;
+}
+
+/* Puts CNT sectors back into the free count, and back into the
+   running thread's claim if RESERVED. */
+static void
+give_free (size_t cnt, bool reserved)
+{
+  lock_acquire (&count_lock);
+  free_cnt += cnt;
+  if (reserved)
+    {
+      thread_current ()->alloc_reserved += cnt;
+      reserved_cnt += cnt;
+    }
+  lock_release (&count_lock);
+}
+
+/* Allocates CNT free sectors in group G, which the caller has
+   locked, at or after FROM if possible, and returns the first, or
+   BITMAP_ERROR if the group has no such run. */
+static size_t
+take_from_group (size_t g, block_sector_t from, size_t cnt)
+{
+  block_sector_t start = g * GROUP_SECTORS;
+  block_sector_t end = group_end (g);
+  size_t sector;
+
+  ASSERT (lock_held_by_current_thread (&groups[g].lock));
+  sector = bitmap_scan_range (free_map, from, end, cnt, false);
+  if (sector == BITMAP_ERROR && from > start)
+    sector = bitmap_scan_range (free_map, start, end, cnt, false);
+  if (sector != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      groups[g].free_cnt -= cnt;
+    }
+  return sector;
+}
+
+/* Notes that the bits of the CNT sectors starting at SECTOR
+   changed, so that free_map_flush() writes them. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void)
 {
+  size_t g;
+
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  dirty_map = bitmap_create (DIV_ROUND_UP (block_size (fs_device),
+                                           BITS_PER_SECTOR));
+  group_cnt = DIV_ROUND_UP (block_size (fs_device), GROUP_SECTORS);
+  groups = malloc (group_cnt * sizeof *groups);
+  if (free_map == NULL || dirty_map == NULL || groups == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  for (g = 0; g < group_cnt; g++)
+    lock_init (&groups[g].lock);
+  lock_init (&count_lock);
+  lock_init (&file_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+  count_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  Sectors reserved with free_map_reserve()
+   are not available, but for those the running thread claimed with
+   free_map_claim_reserved().  The change reaches the free map file on the
+   next free_map_flush().
+   The search starts where the running thread last allocated, or for
+   a thread that has not, in a group picked by its tid, so that
+   threads tend to keep to groups of their own. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct thread *t = thread_current ();
+  block_sector_t goal = t->alloc_hint;
+
+  if (goal == 0)
+    goal = (t->tid % group_cnt) * GROUP_SECTORS;
+  return free_map_allocate_near (goal, cnt, sectorp);
+}
+
+/* Like free_map_allocate(), but looks for the CNT sectors at or
+   after GOAL first, then in the rest of GOAL's block group, then in
+   the groups that follow.  Groups another thread is allocating from
+   are passed over the first time around.  CNT may not exceed the
+   size of a group. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  size_t sector = BITMAP_ERROR;
+  size_t first, pass, i;
+  bool reserved;
+
+  if (cnt == 0 || cnt > GROUP_SECTORS || !take_free (cnt, &reserved))
+    return false;
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  first = goal / GROUP_SECTORS;
+
+  for (pass = 0; pass < 2 && sector == BITMAP_ERROR; pass++)
+    for (i = 0; i < group_cnt && sector == BITMAP_ERROR; i++)
+      {
+        size_t g = (first + i) % group_cnt;
+
+        /* The count is only a hint until the lock is held. */
+        if (groups[g].free_cnt < cnt)
+          continue;
+        if (pass == 0 && !lock_try_acquire (&groups[g].lock))
+          continue;
+        if (pass == 1)
+          lock_acquire (&groups[g].lock);
+        sector = take_from_group (g, i == 0 ? goal : g * GROUP_SECTORS, cnt);
+        lock_release (&groups[g].lock);
+      }
+
+  if (sector == BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      give_free (cnt, reserved);
+      return false;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  mark_dirty (sector, cnt);
+  thread_current ()->alloc_hint = sector + cnt;
+  *sectorp = sector;
+  return true;
+}
+
+/* Returns the first sector of the block group with the most free
+   sectors, a goal for the inode of a new directory. */
+block_sector_t
+free_map_spread_goal (void)
+{
+  size_t best = 0;
+  size_t g;
+
+  for (g = 1; g < group_cnt; g++)
+    if (groups[g].free_cnt > groups[best].free_cnt)
+      best = g;
+  return best * GROUP_SECTORS;
+}
+
+/* Sets aside CNT free sectors, so that allocations made after
+   free_map_unreserve() gives them back are sure to find room.
+   Returns false if there are not that many free sectors. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&count_lock);
+  success = cnt <= free_cnt - reserved_cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&count_lock);
+  return success;
+}
+
+/* Gives back CNT sectors set aside with free_map_reserve(). */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&count_lock);
+  ASSERT (cnt <= reserved_cnt);
+  reserved_cnt -= cnt;
+  lock_release (&count_lock);
+}
+
+/* Lets the allocations the running thread makes from now on use CNT
+   of the sectors set aside with free_map_reserve(), which no other
+   thread can then take first. */
+void
+free_map_claim_reserved (size_t cnt)
+{
+  lock_acquire (&count_lock);
+  thread_current ()->alloc_reserved += cnt;
+  lock_release (&count_lock);
+}
+
+/* Gives back the sectors the running thread claimed with
+   free_map_claim_reserved() and did not use. */
+void
+free_map_return_reserved (void)
+{
+  struct thread *t = thread_current ();
+
+  lock_acquire (&count_lock);
+  ASSERT (t->alloc_reserved <= reserved_cnt);
+  reserved_cnt -= t->alloc_reserved;
+  t->alloc_reserved = 0;
+  lock_release (&count_lock);
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.  They may
+   span several block groups, as merged extents do. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  size_t left = cnt;
+
+  while (left > 0)
+    {
+      size_t g = sector / GROUP_SECTORS;
+      size_t n = group_end (g) - sector;
+      if (n > left)
+        n = left;
+
+      lock_acquire (&groups[g].lock);
+      ASSERT (bitmap_all (free_map, sector, n));
+      bitmap_set_multiple (free_map, sector, n, false);
+      groups[g].free_cnt += n;
+      lock_release (&groups[g].lock);
+      mark_dirty (sector, n);
+
+      sector += n;
+      left -= n;
+    }
+  give_free (cnt, false);
+}
+
+/* Writes the sectors of the free map file that hold bits changed
+   since they were last written.  Writing the free map file may
+   change more bits, if it has to grow the file's block map, so this
+   goes on until none is left.  The caller must hold file_lock, with
+   the file open. */
+static void
+flush_file (void)
+{
+  size_t idx;
+
+  ASSERT (lock_held_by_current_thread (&file_lock));
+  while ((idx = bitmap_scan_and_flip (dirty_map, 0, 1, true)) != BITMAP_ERROR)
+    {
+      size_t start = idx * BITS_PER_SECTOR;
+      size_t cnt = bitmap_size (free_map) - start;
+      if (cnt > BITS_PER_SECTOR)
+        cnt = BITS_PER_SECTOR;
+      if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+        {
+          bitmap_mark (dirty_map, idx);
+          break;
+        }
+    }
+}
+
+/* Writes the free map's changes to the free map file, as
+   flush_file() does.  Does nothing while the file is closed. */
+void
+free_map_flush (void)
+{
+  lock_acquire (&file_lock);
+  if (free_map_file != NULL)
+    flush_file ();
+  lock_release (&file_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void)
 {
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  if (!bitmap_read (free_map, file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
+  count_groups ();
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+
+  lock_acquire (&file_lock);
+  free_map_file = file;
+  lock_release (&file_lock);
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Writes the free map to disk and closes the free map file.  The
+   file is taken out of free_map_file first, so that a concurrent
+   free_map_flush() does not write through it once it is closed. */
 void
 free_map_close (void)
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  lock_acquire (&file_lock);
+  if (free_map_file != NULL)
+    flush_file ();
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&file_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -76,10 +397,15 @@ free_map_create (void)
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map),false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  The file starts out as a hole, so the
+     write allocates its blocks; the bits of those are written by the
+     next flush. */
+  lock_acquire (&file_lock);
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  flush_file ();
+  lock_release (&file_lock);
 }
@@ -1,5 +1,5 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
@@ -7,27 +7,98 @@
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "filesys/bufcache.h"
+#include "filesys/extent.h"
 #include "threads/synch.h"
+#include "devices/timer.h"
 
-/* Identifies an inode. */
+/* Identifies an inode, and which block map format it uses. */
 #define INODE_MAGIC 0x494e4f44
+#define INODE_EXTENT_MAGIC 0x494e4f45
+
+/* Bounds of the read-ahead window, in sectors. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 32
+
+/* Delayed allocation.  An inode holds back at most MAX_PENDING
+   consecutive blocks, and reserves PENDING_METADATA more sectors for
+   the indirect blocks or extent nodes mapping them may take: at most
+   3 indirect blocks, or the nodes an extent tree of the greatest
+   depth grows by if the blocks land in MAX_PENDING separate runs.  All
+   inodes together hold back at most 1/PENDING_FRACTION of the
+   buffer cache, whose entries they keep from being evicted. */
+#define MAX_PENDING 64
+#define PENDING_METADATA 12
+#define PENDING_FRACTION 4
+
+/* Set in a pointer to a data block that was allocated but never
+   written.  Such a block reads as zeros and is only zero-filled, in
+   the buffer cache, when it is first written. */
+#define SECTOR_UNWRITTEN 0x80000000u
+
+/* What a lookup returns for a data block that was never allocated.
+   A pointer to it is 0.  Being marked unwritten, it reads as zeros;
+   it is allocated when first written. */
+#define SECTOR_HOLE (0 | SECTOR_UNWRITTEN)
 
 /* Identify number of direct blocks and indirect blocks in a sector. */
 #define DIRECT_BLOCK_COUNT 123
 #define INDIRECT_BLOCK_COUNT 128
 
+/* Bytes of data a small file keeps in its inode, in place of the
+   block map. */
+#define INLINE_DATA_SIZE ((DIRECT_BLOCK_COUNT + 2) * sizeof (block_sector_t))
+
+/* Inode flags. */
+#define INODE_INLINE 0x1        /* Data kept in the inode itself. */
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t direct_blocks[DIRECT_BLOCK_COUNT];     /* Pointer to direct blocks. */
-    block_sector_t indirect_block;                        /* Pointer to an indirect block. */
-    block_sector_t doubly_indirect_block;                 /* Pointer to a doubly indirect block. */
-    uint32_t isdir;                                       /* Whether it is a directory or file. */
+    union
+      {
+        /* Block map, if MAGIC is INODE_MAGIC. */
+        struct
+          {
+            block_sector_t direct_blocks[DIRECT_BLOCK_COUNT];     /* Pointer to direct blocks. */
+            block_sector_t indirect_block;                        /* Pointer to an indirect block. */
+            block_sector_t doubly_indirect_block;                 /* Pointer to a doubly indirect block. */
+          };
+        struct extent_root extents;     /* If MAGIC is INODE_EXTENT_MAGIC. */
+        uint8_t inline_data[INLINE_DATA_SIZE];  /* If FLAGS has INODE_INLINE. */
+      };
+    uint16_t isdir;                                       /* Whether it is a directory or file. */
+    uint16_t flags;                                       /* INODE_* flags. */
     off_t length;                                         /* File size in bytes. */
     unsigned magic;                                       /* Magic number. */
   };
 
+/* Returns true if DISK_INODE maps its blocks with extents. */
+static inline bool
+uses_extents (const struct inode_disk *disk_inode)
+{
+  return disk_inode->magic == INODE_EXTENT_MAGIC;
+}
+
+/* Returns true if DISK_INODE keeps its data inline. */
+static inline bool
+uses_inline (const struct inode_disk *disk_inode)
+{
+  return (disk_inode->flags & INODE_INLINE) != 0;
+}
+
+/* Format of the inodes created from now on. */
+static enum inode_format new_inode_format = INODE_BLOCKMAP;
+
+/* Whether appended blocks get their sectors late, in runs. */
+static bool delalloc;
+
+/* Blocks held back by all inodes, and the next run of virtual
+   sectors to hand out, protected by delalloc_lock. */
+static struct lock delalloc_lock;
+static size_t pending_total;
+static block_sector_t next_virtual = BUFCACHE_VIRTUAL_BASE;
+
 /* Struct definition for indirect blocks. */
 struct indirect_block {
   block_sector_t blocks[INDIRECT_BLOCK_COUNT];
@@ -44,63 +115,283 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
-    int open_cnt;                       /* Number of openers. */
+    int open_cnt;                       /* Number of openers, under open_inodes_lock. */
+    bool ready;                         /* DATA has been read in. */
+    struct condition until_ready;
+    bool closing;                       /* Last closer is tearing it down. */
     bool removed;                       /* True if deleted, false otherwise. */
     bool extended;                      /* Whether the file is extended or not. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct lock inode_lock;             /* Synchronizing in-memory state for this inode. */
     struct condition until_not_extending; // 
-    struct condition until_no_writers; // no read and write at the same time (might not be necessary)
+    struct list ranges;                 /* Byte ranges being read or written. */
+    struct condition until_range_released;
+    struct inode_disk data;             /* Inode content, written back on change. */
+
+    /* Delayed allocation: blocks PENDING_FIRST up to PENDING_FIRST +
+       PENDING_CNT are holes in DATA, but were written, to the virtual
+       sectors from PENDING_BASE on, since tick PENDING_SINCE. */
+    uint32_t pending_first;
+    uint32_t pending_cnt;
+    block_sector_t pending_base;
+    int64_t pending_since;
   };
 
+/* A byte range of an inode that a reader or writer is transferring.
+   Ranges of two writers, or of a reader and a writer, never overlap;
+   the block map and length are only touched with the inode's lock
+   held, but the lock is dropped while data moves. */
+struct inode_range
+  {
+    struct list_elem elem;      /* Element in the inode's ranges. */
+    off_t start, end;           /* Bytes START up to END. */
+    bool write;                 /* True for a writer. */
+  };
+
+/* Writes INODE's in-memory copy of its on-disk inode back through
+   the buffer cache. */
+static void
+inode_write_disk (struct inode *inode)
+{
+  bufcache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Returns entry INDEX of the indirect block in SECTOR, read in place
+   in the buffer cache. */
+static block_sector_t
+indirect_lookup (block_sector_t sector, off_t index)
+{
+  struct indirect_block *block_indirect = bufcache_get (sector, false);
+  block_sector_t rv = block_indirect->blocks[index];
+  bufcache_put (sector);
+  return rv;
+}
+
+/* A position in the block map of an inode.  It remembers the indirect
+   block that maps the blocks it last looked up, so that walking a file
+   sequentially costs one buffer cache lookup per data block, plus one
+   per INDIRECT_BLOCK_COUNT blocks to find the next indirect block.
+   The inode's lock must be held while a cursor is in use. */
+struct block_cursor
+  {
+    struct inode *inode;
+    off_t leaf_base;            /* First block mapped by LEAF, or -1. */
+    block_sector_t leaf;        /* Indirect block last used. */
+    struct extent extent;       /* Extent last found, if any blocks. */
+  };
+
+/* Initializes C at the start of INODE's block map. */
+static void
+cursor_init (struct block_cursor *c, struct inode *inode)
+{
+  c->inode = inode;
+  c->leaf_base = -1;
+  c->extent.length = 0;
+}
+
+/* Finds where the pointer to data block INDEX is stored.  If it is a
+   direct pointer, returns false and sets *SLOT to its index in the
+   inode.  Otherwise returns true and sets *LEAF and *SLOT to the
+   indirect block holding it and its index there; *LEAF is 0 if that
+   indirect block was never allocated. */
+static bool
+cursor_locate (struct block_cursor *c, off_t index,
+               block_sector_t *leaf, off_t *slot)
+{
+  const struct inode_disk *disk_inode = &c->inode->data;
+
+  /* Scenario 1: Direct blocks are sufficient. */
+  if (index < DIRECT_BLOCK_COUNT)
+    {
+      *slot = index;
+      return false;
+    }
+
+  /* Scenario 2: Direct blocks and indirect blocks are sufficient. */
+  if (index < DIRECT_BLOCK_COUNT + INDIRECT_BLOCK_COUNT)
+    {
+      if (c->leaf_base != DIRECT_BLOCK_COUNT)
+        {
+          c->leaf = disk_inode->indirect_block;
+          c->leaf_base = DIRECT_BLOCK_COUNT;
+        }
+    }
+  /* Scenario 3: Direct blocks, indirect blocks, and doubly indirect blocks are sufficient. */
+  else
+    {
+      off_t remaining_index = index - DIRECT_BLOCK_COUNT - INDIRECT_BLOCK_COUNT;
+      off_t base = index - remaining_index % INDIRECT_BLOCK_COUNT;
+      if (c->leaf_base != base)
+        {
+          c->leaf = disk_inode->doubly_indirect_block;
+          if (c->leaf != 0)
+            c->leaf = indirect_lookup (c->leaf, remaining_index / INDIRECT_BLOCK_COUNT);
+          c->leaf_base = base;
+        }
+    }
+  *leaf = c->leaf;
+  *slot = index - c->leaf_base;
+  return true;
+}
+
+/* Returns the sector of data block BLOCK of C's inode, which maps
+   its blocks with extents, marked SECTOR_UNWRITTEN like a block map
+   pointer if it was never written.  Returns SECTOR_HOLE if BLOCK is
+   in a hole. */
+static block_sector_t
+cursor_lookup_extent (struct block_cursor *c, uint32_t block)
+{
+  block_sector_t sector;
+
+  if (block - c->extent.file_block >= extent_length (&c->extent)
+      && !extent_find (&c->inode->data.extents, block, &c->extent))
+    return SECTOR_HOLE;
+  sector = c->extent.start + (block - c->extent.file_block);
+  return extent_unwritten (&c->extent) ? sector | SECTOR_UNWRITTEN : sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within C's inode, or SECTOR_HOLE if none was allocated.
+   Returns -1 if the inode does not contain data for a byte at offset
+   POS. */
+static block_sector_t
+cursor_lookup (struct block_cursor *c, off_t pos)
+{
+  block_sector_t leaf, rv;
+  off_t slot;
+
+  if (pos >= c->inode->data.length)
+    return -1;
+  ASSERT (!uses_inline (&c->inode->data));
+  if ((uint32_t) pos / BLOCK_SECTOR_SIZE - c->inode->pending_first < c->inode->pending_cnt)
+    return (c->inode->pending_base
+            + (pos / BLOCK_SECTOR_SIZE - c->inode->pending_first));
+  if (uses_extents (&c->inode->data))
+    return cursor_lookup_extent (c, pos / BLOCK_SECTOR_SIZE);
+  if (!cursor_locate (c, pos / BLOCK_SECTOR_SIZE, &leaf, &slot))
+    rv = c->inode->data.direct_blocks[slot];
+  else if (leaf == 0)
+    return SECTOR_HOLE;
+  else
+    rv = indirect_lookup (leaf, slot);
+  return rv != 0 ? rv : SECTOR_HOLE;
+}
+
+/* Returns the block device sector that contains byte offset POS
+   within INODE, or SECTOR_HOLE if none was allocated.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
-  block_sector_t rv = -1;
-  struct inode_disk *disk_inode = (struct inode_disk *)malloc(sizeof(struct inode_disk));
-  bufcache_read(inode_get_inumber(inode), disk_inode, 0, BLOCK_SECTOR_SIZE);
-
-  if (pos < disk_inode->length) {
-    off_t index = pos / BLOCK_SECTOR_SIZE;
-
-    /* Scenario 1: Direct blocks are sufficient. */
-    if (index < DIRECT_BLOCK_COUNT) {
-      rv = disk_inode->direct_blocks[index];
-    }
-    /* Scenario 2: Direct blocks and indirect blocks are sufficient. */
-    else if (index < DIRECT_BLOCK_COUNT + INDIRECT_BLOCK_COUNT) {
-      off_t remaining_index = index - DIRECT_BLOCK_COUNT;
-      struct indirect_block block_indirect;
-      bufcache_read(disk_inode->indirect_block, &block_indirect, 0, BLOCK_SECTOR_SIZE);
-      rv = block_indirect.blocks[remaining_index];
-    }
-    /* Scenario 3: Direct blocks, indirect blocks, and doubly indirect blocks are sufficient. */
-    else {
-      off_t remaining_index = index - DIRECT_BLOCK_COUNT - INDIRECT_BLOCK_COUNT;
-      struct indirect_block first_level_block_indirect;
-      bufcache_read(disk_inode->doubly_indirect_block, &first_level_block_indirect, 0, BLOCK_SECTOR_SIZE);
-      struct indirect_block second_level_block_indirect;
-      bufcache_read(first_level_block_indirect.blocks[remaining_index / INDIRECT_BLOCK_COUNT], &second_level_block_indirect, 0, BLOCK_SECTOR_SIZE);
-      rv = second_level_block_indirect.blocks[remaining_index % INDIRECT_BLOCK_COUNT];
+  struct block_cursor c;
+  cursor_init (&c, inode);
+  return cursor_lookup (&c, pos);
+}
+
+/* Returns the sector to allocate data block BLOCK of INODE near:
+   the one after the block before it, if that block has a sector, or
+   else the one after INODE's own sector. */
+static block_sector_t
+inode_goal (struct inode *inode, uint32_t block)
+{
+  if (block > 0 && !uses_inline (&inode->data))
+    {
+      block_sector_t prev = byte_to_sector (inode, (off_t) (block - 1) * BLOCK_SECTOR_SIZE);
+      if (prev != (block_sector_t) -1)
+        {
+          prev &= ~SECTOR_UNWRITTEN;
+          if (prev != 0 && prev < BUFCACHE_VIRTUAL_BASE)
+            return prev + 1;
+        }
     }
-  }
+  return inode->sector + 1;
+}
 
-  free(disk_inode);
+/* Clears the unwritten mark of entry INDEX of the indirect block in
+   SECTOR and returns the entry as it was before. */
+static block_sector_t
+indirect_clear_unwritten (block_sector_t sector, off_t index)
+{
+  struct indirect_block *block_indirect = bufcache_get (sector, true);
+  block_sector_t rv = block_indirect->blocks[index];
+  if (rv & SECTOR_UNWRITTEN)
+    {
+      block_indirect->blocks[index] = rv & ~SECTOR_UNWRITTEN;
+      bufcache_mark_dirty (sector);
+    }
+  bufcache_put (sector);
   return rv;
 }
 
+/* Turns the never-written data block that contains byte offset POS
+   within C's inode into a regular one, which is zero-filled in the
+   buffer cache unless the caller is about to overwrite it WHOLE.
+   A writer of another part of the block may have beaten us to it,
+   in which case the block is left alone.
+   Returns its sector, or -1 if the disk is too full to record that
+   the block was written. */
+static block_sector_t
+cursor_materialize (struct block_cursor *c, off_t pos, bool whole)
+{
+  struct inode_disk *disk_inode = &c->inode->data;
+  block_sector_t leaf, old, rv;
+  off_t slot;
+
+  ASSERT (lock_held_by_current_thread (&c->inode->inode_lock));
+  if (uses_extents (disk_inode))
+    {
+      /* The cursor's extent may predate the other writer's. */
+      c->extent.length = 0;
+      old = cursor_lookup_extent (c, pos / BLOCK_SECTOR_SIZE);
+      if (old & SECTOR_UNWRITTEN)
+        {
+          rv = extent_materialize (&disk_inode->extents, pos / BLOCK_SECTOR_SIZE);
+          c->extent.length = 0;
+          inode_write_disk (c->inode);
+          if (rv == (block_sector_t) -1)
+            return rv;
+        }
+    }
+  else if (cursor_locate (c, pos / BLOCK_SECTOR_SIZE, &leaf, &slot))
+    old = indirect_clear_unwritten (leaf, slot);
+  else
+    {
+      old = disk_inode->direct_blocks[slot];
+      if (old & SECTOR_UNWRITTEN)
+        {
+          disk_inode->direct_blocks[slot] = old & ~SECTOR_UNWRITTEN;
+          inode_write_disk (c->inode);
+        }
+    }
+
+  rv = old & ~SECTOR_UNWRITTEN;
+  if ((old & SECTOR_UNWRITTEN) && !whole)
+    bufcache_zero (rv);
+  return rv;
+}
+
+/* Sectors taken from the free map in one run, handed out in order to
+   the data blocks of a single allocation so that they are contiguous
+   on disk. */
+struct sector_run
+  {
+    block_sector_t next;        /* Next sector of the run. */
+    size_t cnt;                 /* Sectors left in the run. */
+    size_t blocks;              /* Blocks of the allocation not yet visited. */
+    block_sector_t goal;        /* Where to look for the next run. */
+  };
+
 /* The following functions are thin wrappers around free_map_allocate(). */
-static bool inode_allocate_sector (block_sector_t *sector);
-static bool inode_allocate_indirect (block_sector_t *sector, size_t count);
-static bool inode_allocate_doubly_indirect (block_sector_t *sector, size_t count);
-static bool inode_allocate (struct inode_disk *disk_inode, off_t length);
+static bool inode_allocate_metadata (block_sector_t *sector, block_sector_t goal);
+static bool inode_allocate_sector (block_sector_t *sector, struct sector_run *run);
+static bool inode_allocate_indirect (block_sector_t *sector, size_t from, size_t to, struct sector_run *run);
+static bool inode_allocate_doubly_indirect (block_sector_t *sector, size_t from, size_t to, struct sector_run *run);
+static bool inode_allocate_blocks (struct inode_disk *disk_inode, size_t first, size_t end, struct sector_run *run);
+static bool inode_allocate (struct inode_disk *disk_inode, off_t offset, off_t length, block_sector_t goal);
 
 /* The following functions are thin wrappers around free_map_release(). */
 static void inode_deallocate_sector (block_sector_t sector);
@@ -108,136 +399,236 @@ static void inode_deallocate_indirect (block_sector_t sector, size_t count);
 static void inode_deallocate_doubly_indirect (block_sector_t sector, size_t count);
 static void inode_deallocate (struct inode *inode);
 
-/* Allocate a sector for a direct pointer. */
-static bool inode_allocate_sector (block_sector_t *sector) {
-  char buffer[BLOCK_SECTOR_SIZE];
-  memset(buffer, 0, BLOCK_SECTOR_SIZE);
+/* Allocate a zeroed sector for an indirect block, near GOAL. */
+static bool inode_allocate_metadata (block_sector_t *sector, block_sector_t goal) {
   if (!*sector) {
-    if (!free_map_allocate(1, sector)) {
+    if (!free_map_allocate_near(goal, 1, sector)) {
       return false;
     }
-    bufcache_write(*sector, buffer, 0, BLOCK_SECTOR_SIZE);
+    bufcache_zero(*sector);
   }
   return true;
 }
 
-/* Allocate a sector for an indirect pointer. */
-static bool inode_allocate_indirect (block_sector_t *sector, size_t count) {
-  /* First try to allocate the first level sector. */
-  if (!inode_allocate_sector(sector)) {
-    return false;
-  }
-
-  struct indirect_block block_indirect;
-  bufcache_read(*sector, &block_indirect, 0, BLOCK_SECTOR_SIZE);
-
-  /* Allocate COUNT of data sectors. */
-  for (size_t i = 0; i < count; i += 1) {
-    if (!inode_allocate_sector(&block_indirect.blocks[i])) {
-      return false;
+/* Allocate a sector from RUN for a direct pointer, unless it already
+   has one.  When RUN is used up, it takes the longest run the free map
+   has for the blocks left from its goal on, halving on failure.
+   Nothing is written:
+   the pointer is marked unwritten until the data block is first
+   written. */
+static bool inode_allocate_sector (block_sector_t *sector, struct sector_run *run) {
+  ASSERT (run->blocks > 0);
+  run->blocks -= 1;
+  if (!*sector) {
+    if (run->cnt == 0) {
+      size_t cnt = run->blocks + 1;
+      while (!free_map_allocate_near(run->goal, cnt, &run->next)) {
+        if (cnt == 1) {
+          return false;
+        }
+        cnt /= 2;
+      }
+      run->cnt = cnt;
+      run->goal = run->next + cnt;
     }
+    *sector = run->next | SECTOR_UNWRITTEN;
+    run->next += 1;
+    run->cnt -= 1;
   }
-
-  bufcache_write(*sector, &block_indirect, 0, BLOCK_SECTOR_SIZE);
   return true;
 }
 
-/* Allocate a sector for a doubly indirect pointer. */
-static bool inode_allocate_doubly_indirect (block_sector_t *sector, size_t count) {
+/* Allocate a sector for an indirect pointer, and the data sectors
+   for its entries FROM up to TO that are holes. */
+static bool inode_allocate_indirect (block_sector_t *sector, size_t from, size_t to, struct sector_run *run) {
   /* First try to allocate the first level sector. */
-  if (!inode_allocate_sector(sector)) {
+  if (!inode_allocate_metadata(sector, run->goal)) {
     return false;
   }
 
-  struct indirect_block first_level_block_indirect;
-  bufcache_read(*sector, &first_level_block_indirect, 0, BLOCK_SECTOR_SIZE);
-
-  size_t num_second_level_blocks = DIV_ROUND_UP(count, INDIRECT_BLOCK_COUNT);
-  for (size_t i = 0; i < num_second_level_blocks; i += 1) {
-    size_t num_to_allocate = count < INDIRECT_BLOCK_COUNT? count : INDIRECT_BLOCK_COUNT;
-    if (!inode_allocate_indirect(&first_level_block_indirect.blocks[i], num_to_allocate)) {
-      return false;
-    }
-    count -= num_to_allocate;
+  /* Allocate the data sectors, filling in the indirect block in place. */
+  struct indirect_block *block_indirect = bufcache_get(*sector, true);
+  bool success = true;
+  for (size_t i = from; i < to && success; i += 1) {
+    block_sector_t data = block_indirect->blocks[i];
+    success = inode_allocate_sector(&block_indirect->blocks[i], run);
+    if (block_indirect->blocks[i] != data)
+      bufcache_mark_dirty(*sector);
   }
-
-  bufcache_write(*sector, &first_level_block_indirect, 0, BLOCK_SECTOR_SIZE);
-  return true;
+  bufcache_put(*sector);
+  return success;
 }
 
-/* Allocate all the inodes needed given the length of the file. */
-static bool inode_allocate (struct inode_disk *disk_inode, off_t length) {
-  /* Basic check. */
-  ASSERT (disk_inode != NULL);
-  if (length < 0) {
+/* Allocate a sector for a doubly indirect pointer, and the data
+   sectors for its blocks FROM up to TO that are holes. */
+static bool inode_allocate_doubly_indirect (block_sector_t *sector, size_t from, size_t to, struct sector_run *run) {
+  /* First try to allocate the first level sector. */
+  if (!inode_allocate_metadata(sector, run->goal)) {
     return false;
   }
 
-  /* Total number of sector needed and number of sectors to allocate in each level. */
-  size_t remaining_num_sectors = bytes_to_sectors(length);
-  size_t num_to_allocate;
+  struct indirect_block *first_level_block_indirect = bufcache_get(*sector, true);
+  bool success = true;
+  size_t last_second_level_block = DIV_ROUND_UP(to, INDIRECT_BLOCK_COUNT);
+  for (size_t i = from / INDIRECT_BLOCK_COUNT; i < last_second_level_block && success; i += 1) {
+    size_t base = i * INDIRECT_BLOCK_COUNT;
+    size_t sub_from = from > base? from - base : 0;
+    size_t sub_to = to < base + INDIRECT_BLOCK_COUNT? to - base : INDIRECT_BLOCK_COUNT;
+    block_sector_t second_level = first_level_block_indirect->blocks[i];
+    success = inode_allocate_indirect(&first_level_block_indirect->blocks[i], sub_from, sub_to, run);
+    if (first_level_block_indirect->blocks[i] != second_level)
+      bufcache_mark_dirty(*sector);
+  }
+  bufcache_put(*sector);
+  return success;
+}
 
+/* Allocate the data blocks FIRST up to END of a block map that are
+   holes, from RUN, and the indirect blocks needed to map them. */
+static bool inode_allocate_blocks (struct inode_disk *disk_inode, size_t first, size_t end, struct sector_run *run) {
   /* Allocate direct blocks. */
-  num_to_allocate = remaining_num_sectors < DIRECT_BLOCK_COUNT? remaining_num_sectors : DIRECT_BLOCK_COUNT;
-  for (size_t i = 0; i < num_to_allocate; i += 1) {
-    if (!inode_allocate_sector(&disk_inode->direct_blocks[i])) {
+  for (size_t i = first; i < end && i < DIRECT_BLOCK_COUNT; i += 1) {
+    if (!inode_allocate_sector(&disk_inode->direct_blocks[i], run)) {
       return false;
     }
   }
-  remaining_num_sectors -= num_to_allocate;
-  if (remaining_num_sectors == 0) {
+  if (end <= DIRECT_BLOCK_COUNT) {
     return true;
   }
 
   /* Allocate indirect blocks. */
-  num_to_allocate = remaining_num_sectors < INDIRECT_BLOCK_COUNT? remaining_num_sectors : INDIRECT_BLOCK_COUNT;
-  if (!inode_allocate_indirect(&disk_inode->indirect_block, num_to_allocate)) {
-    return false;
+  size_t base = DIRECT_BLOCK_COUNT;
+  if (first < base + INDIRECT_BLOCK_COUNT) {
+    size_t from = first > base? first - base : 0;
+    size_t to = end < base + INDIRECT_BLOCK_COUNT? end - base : INDIRECT_BLOCK_COUNT;
+    if (!inode_allocate_indirect(&disk_inode->indirect_block, from, to, run)) {
+      return false;
+    }
   }
-  remaining_num_sectors -= num_to_allocate;
-  if (remaining_num_sectors == 0) {
+  if (end <= base + INDIRECT_BLOCK_COUNT) {
     return true;
   }
 
   /* Allocate doubly indirect blocks. */
-  num_to_allocate = remaining_num_sectors < INDIRECT_BLOCK_COUNT * INDIRECT_BLOCK_COUNT? remaining_num_sectors : INDIRECT_BLOCK_COUNT * INDIRECT_BLOCK_COUNT;
-  if (!inode_allocate_doubly_indirect(&disk_inode->doubly_indirect_block, num_to_allocate)) {
+  base += INDIRECT_BLOCK_COUNT;
+  if (end > base + INDIRECT_BLOCK_COUNT * INDIRECT_BLOCK_COUNT) {
     return false;
   }
-  remaining_num_sectors -= num_to_allocate;
+  return inode_allocate_doubly_indirect(&disk_inode->doubly_indirect_block,
+                                        first > base? first - base : 0, end - base, run);
+}
 
-  ASSERT(remaining_num_sectors == 0);
+/* Allocate the data blocks holding bytes OFFSET up to OFFSET + LENGTH
+   that are holes, and the indirect blocks needed to map them.  The
+   data blocks are taken in as few runs as the free map allows, from
+   GOAL on, and are left unwritten. */
+static bool inode_allocate (struct inode_disk *disk_inode, off_t offset, off_t length, block_sector_t goal) {
+  /* Basic check. */
+  ASSERT (disk_inode != NULL);
+  if (offset < 0 || length < 0) {
+    return false;
+  }
+  if (length == 0) {
+    return true;
+  }
+
+  /* Blocks FIRST up to END are to be allocated. */
+  size_t first = offset / BLOCK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors(offset + length);
+  if (uses_extents(disk_inode)) {
+    return extent_allocate(&disk_inode->extents, first, end, goal);
+  }
+
+  /* Give back what is left of the last run, if some of the blocks
+     were already allocated. */
+  struct sector_run run = {0, 0, end - first, goal};
+  bool success = inode_allocate_blocks(disk_inode, first, end, &run);
+  if (run.cnt > 0) {
+    free_map_release(run.next, run.cnt);
+  }
+  return success;
+}
+
+/* Point entry INDEX of the indirect block in *SECTOR, allocating that
+   block if need be, at data sector DATA. */
+static bool inode_map_indirect (block_sector_t *sector, size_t index, block_sector_t data) {
+  if (!inode_allocate_metadata(sector, data)) {
+    return false;
+  }
+  struct indirect_block *block_indirect = bufcache_get(*sector, true);
+  ASSERT (block_indirect->blocks[index] == 0);
+  block_indirect->blocks[index] = data;
+  bufcache_mark_dirty(*sector);
+  bufcache_put(*sector);
   return true;
 }
 
-/* Deallocate a sector for a direct pointer. */
+/* Point the pointer to data block INDEX, a hole, at the written
+   sector DATA, allocating indirect blocks as needed. */
+static bool inode_map_sector (struct inode_disk *disk_inode, size_t index, block_sector_t data) {
+  /* Direct blocks. */
+  if (index < DIRECT_BLOCK_COUNT) {
+    ASSERT (disk_inode->direct_blocks[index] == 0);
+    disk_inode->direct_blocks[index] = data;
+    return true;
+  }
+
+  /* Indirect blocks. */
+  index -= DIRECT_BLOCK_COUNT;
+  if (index < INDIRECT_BLOCK_COUNT) {
+    return inode_map_indirect(&disk_inode->indirect_block, index, data);
+  }
+
+  /* Doubly indirect blocks. */
+  index -= INDIRECT_BLOCK_COUNT;
+  if (index >= INDIRECT_BLOCK_COUNT * INDIRECT_BLOCK_COUNT
+      || !inode_allocate_metadata(&disk_inode->doubly_indirect_block, data)) {
+    return false;
+  }
+  block_sector_t sector = disk_inode->doubly_indirect_block;
+  struct indirect_block *first_level_block_indirect = bufcache_get(sector, true);
+  block_sector_t *second_level = &first_level_block_indirect->blocks[index / INDIRECT_BLOCK_COUNT];
+  bool success = *second_level != 0 || inode_allocate_metadata(second_level, data);
+  block_sector_t second_level_sector = *second_level;
+  bufcache_mark_dirty(sector);
+  bufcache_put(sector);
+  return success && inode_map_indirect(&second_level_sector, index % INDIRECT_BLOCK_COUNT, data);
+}
+
+/* Deallocate a sector for a direct pointer, unless it is a hole. */
 static void inode_deallocate_sector (block_sector_t sector) {
-  free_map_release(sector, 1);
+  if (sector) {
+    free_map_release(sector & ~SECTOR_UNWRITTEN, 1);
+  }
 }
 
 /* Dealllocate sectors for an indrect pointer. */
 static void inode_deallocate_indirect (block_sector_t sector, size_t count) {
-  struct indirect_block block_indirect;
-  bufcache_read(sector, &block_indirect, 0, BLOCK_SECTOR_SIZE);
-
+  if (!sector) {
+    return;
+  }
+  struct indirect_block *block_indirect = bufcache_get(sector, false);
   for (size_t i = 0; i < count; i += 1) {
-    inode_deallocate_sector(block_indirect.blocks[i]);
+    inode_deallocate_sector(block_indirect->blocks[i]);
   }
+  bufcache_put(sector);
 
   inode_deallocate_sector(sector);
 }
 
 /* Deallocate sectors for a doubly indirect pointer. */
 static void inode_deallocate_doubly_indirect (block_sector_t sector, size_t count) {
-  struct indirect_block first_level_block_indirect;
-  bufcache_read(sector, &first_level_block_indirect, 0, BLOCK_SECTOR_SIZE);
-
+  if (!sector) {
+    return;
+  }
+  struct indirect_block *first_level_block_indirect = bufcache_get(sector, false);
   size_t num_second_level_blocks = DIV_ROUND_UP(count, INDIRECT_BLOCK_COUNT);
   for (size_t i = 0; i < num_second_level_blocks; i += 1) {
     size_t num_to_deallocate = count < INDIRECT_BLOCK_COUNT? count: INDIRECT_BLOCK_COUNT;
-    inode_deallocate_indirect(first_level_block_indirect.blocks[i], num_to_deallocate);
+    inode_deallocate_indirect(first_level_block_indirect->blocks[i], num_to_deallocate);
     count -= num_to_deallocate;
   }
+  bufcache_put(sector);
 
   inode_deallocate_sector(sector);
 }
@@ -247,12 +638,19 @@ static void inode_deallocate (struct inode *inode) {
   /* Basic check. */
   ASSERT(inode != NULL);
 
-  /* Get the corresponding disk inode. */
-  struct inode_disk *disk_inode = (struct inode_disk *)malloc(sizeof(struct inode_disk));
-  bufcache_read(inode_get_inumber(inode), disk_inode, 0, BLOCK_SECTOR_SIZE);
+  struct inode_disk *disk_inode = &inode->data;
+  if (uses_inline(disk_inode)) {
+    return;
+  }
+  if (uses_extents(disk_inode)) {
+    extent_free(&disk_inode->extents);
+    return;
+  }
 
-  /* Total number of sector needed to free and number of sectors to deallocate in each level. */
-  size_t remaining_num_sectors = bytes_to_sectors(disk_inode->length);
+  /* Number of sectors to look at and number of sectors to deallocate in each level.
+     Holes aside, blocks past the end of file may be allocated, so look at all. */
+  size_t remaining_num_sectors = DIRECT_BLOCK_COUNT + INDIRECT_BLOCK_COUNT
+                                 + INDIRECT_BLOCK_COUNT * INDIRECT_BLOCK_COUNT;
   size_t num_to_deallocate;
 
   /* Deallocate direct blocks. */
@@ -262,7 +660,6 @@ static void inode_deallocate (struct inode *inode) {
   }
   remaining_num_sectors -= num_to_deallocate;
   if (remaining_num_sectors == 0) {
-    free(disk_inode);
     return;
   }
 
@@ -271,7 +668,6 @@ static void inode_deallocate (struct inode *inode) {
   inode_deallocate_indirect(disk_inode->indirect_block, num_to_deallocate);
   remaining_num_sectors -= num_to_deallocate;
   if (remaining_num_sectors == 0) {
-    free(disk_inode);
     return;
   }
 
@@ -281,23 +677,157 @@ static void inode_deallocate (struct inode *inode) {
   remaining_num_sectors -= num_to_deallocate;
 
   ASSERT(remaining_num_sectors == 0);
-  free(disk_inode);
   return;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Holds back data block BLOCK of INODE, a hole about to be written,
+   from getting a sector, if it extends INODE's run of such blocks and
+   there is room.  Returns true if successful; the block then maps to
+   a virtual sector in the buffer cache. */
+static bool
+inode_delay_block (struct inode *inode, uint32_t block)
+{
+  bool success;
+
+  ASSERT (lock_held_by_current_thread (&inode->inode_lock));
+  if (!delalloc || inode->sector == FREE_MAP_SECTOR
+      || inode->pending_cnt == MAX_PENDING
+      || (inode->pending_cnt > 0
+          && block != inode->pending_first + inode->pending_cnt))
+    return false;
+
+  lock_acquire (&delalloc_lock);
+  success = (pending_total < bufcache_size () / PENDING_FRACTION
+             && free_map_reserve (inode->pending_cnt == 0 ? 1 + PENDING_METADATA : 1));
+  if (success)
+    {
+      pending_total++;
+      if (inode->pending_cnt == 0)
+        {
+          if (next_virtual + MAX_PENDING > SECTOR_UNWRITTEN)
+            next_virtual = BUFCACHE_VIRTUAL_BASE;
+          inode->pending_base = next_virtual;
+          inode->pending_first = block;
+          inode->pending_since = timer_ticks ();
+          next_virtual += MAX_PENDING;
+        }
+      inode->pending_cnt++;
+    }
+  lock_release (&delalloc_lock);
+  return success;
+}
+
+/* Gives back the free map reservation of the blocks INODE holds back. */
+static void
+inode_unreserve_pending (struct inode *inode)
+{
+  lock_acquire (&delalloc_lock);
+  free_map_unreserve (inode->pending_cnt + PENDING_METADATA);
+  lock_release (&delalloc_lock);
+}
 
-/* A lock to synchronize the list above. */
+/* Forgets the blocks INODE holds back, once they have a sector or
+   their data is to be thrown away, and drops their virtual sectors. */
+static void
+inode_release_pending (struct inode *inode)
+{
+  for (uint32_t i = 0; i < inode->pending_cnt; i++)
+    bufcache_discard (inode->pending_base + i);
+  lock_acquire (&delalloc_lock);
+  pending_total -= inode->pending_cnt;
+  lock_release (&delalloc_lock);
+  inode->pending_cnt = 0;
+}
+
+/* Gives the blocks INODE holds back their sectors, in as few runs as
+   the free map allows, and moves their data over from the virtual
+   sectors.  Nobody else may be reading or writing those blocks. */
+static void
+inode_flush_pending (struct inode *inode)
+{
+  uint32_t done = 0;
+  block_sector_t goal;
+
+  ASSERT (lock_held_by_current_thread (&inode->inode_lock));
+  if (inode->pending_cnt == 0)
+    return;
+
+  /* Allocate out of the reservation, so that nobody else can take
+     the sectors it holds for these blocks in the meantime. */
+  free_map_claim_reserved (inode->pending_cnt + PENDING_METADATA);
+
+  /* Each run goes right after the one before it, so that a run the
+     free map could only supply in pieces still ends up in order.
+     inode_goal() would not see the pieces already placed, because
+     their blocks still map to virtual sectors until the end. */
+  goal = inode_goal (inode, inode->pending_first);
+  while (done < inode->pending_cnt)
+    {
+      size_t cnt = inode->pending_cnt - done;
+      uint32_t first = inode->pending_first + done;
+      block_sector_t start;
+      bool allocated, mapped = true;
+
+      /* Take the longest run we can get, halving on failure. */
+      while (!(allocated = free_map_allocate_near (goal, cnt, &start))
+             && cnt > 1)
+        cnt /= 2;
+      if (!allocated)
+        break;
+
+      if (uses_extents (&inode->data))
+        mapped = extent_map (&inode->data.extents, first, start, cnt);
+      else
+        for (size_t i = 0; i < cnt && mapped; i++)
+          mapped = inode_map_sector (&inode->data, first + i, start + i);
+      if (!mapped)
+        {
+          /* Only if the reservation fell short of the metadata, which
+             PENDING_METADATA is sized to prevent. */
+          free_map_release (start, cnt);
+          break;
+        }
+
+      for (size_t i = 0; i < cnt; i++)
+        bufcache_move (inode->pending_base + done + i, start + i);
+      done += cnt;
+      goal = start + cnt;
+    }
+  free_map_return_reserved ();
+  inode_write_disk (inode);
+  inode_release_pending (inode);
+}
+
+/* Open inodes, indexed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* A lock to synchronize the table above. */
 struct lock open_inodes_lock;
 
+/* Hash function and comparator for open_inodes. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
   lock_init(&open_inodes_lock);
+  lock_init(&delalloc_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -322,37 +852,130 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
     {
       disk_inode->isdir = isdir;
       disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (inode_allocate(disk_inode, length)) {
-        bufcache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
-        success = true;
-      }
+      disk_inode->magic = (new_inode_format == INODE_EXTENTS
+                           ? INODE_EXTENT_MAGIC : INODE_MAGIC);
+      if (length <= (off_t) INLINE_DATA_SIZE)
+        disk_inode->flags = INODE_INLINE;
+      /* All LENGTH bytes start out as zeros, inline or in a hole. */
+      bufcache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+      success = true;
       free (disk_inode);
     }
   return success;
 }
 
+/* Makes blocks appended from now on get their sectors when they are
+   flushed, rather than when they are first written, if DELAY. */
+void
+inode_set_delalloc (bool delay)
+{
+  delalloc = delay;
+}
+
+/* Gives the blocks INODE holds back their sectors, once nobody is
+   transferring data to or from INODE.  If LAST, the caller is INODE's
+   last closer, and the blocks of a removed INODE are thrown away
+   instead; other openers of a removed inode may still read them. */
+static void
+inode_settle_pending (struct inode *inode, bool last)
+{
+  lock_acquire (&inode->inode_lock);
+  while (inode->extended)
+    cond_wait (&inode->until_not_extending, &inode->inode_lock);
+  inode->extended = true;
+  while (!list_empty (&inode->ranges))
+    cond_wait (&inode->until_range_released, &inode->inode_lock);
+  if (last && inode->removed)
+    {
+      inode_unreserve_pending (inode);
+      inode_release_pending (inode);
+    }
+  else
+    inode_flush_pending (inode);
+  inode->extended = false;
+  cond_broadcast (&inode->until_not_extending, &inode->inode_lock);
+  cond_broadcast (&inode->until_range_released, &inode->inode_lock);
+  lock_release (&inode->inode_lock);
+}
+
+/* Gives the blocks that open inodes have held back for at least
+   MIN_AGE ticks their sectors, so that their data can be written
+   back.  The inodes are visited in order of sector, each kept open
+   while it is flushed, so that open_inodes_lock is not held across
+   the I/O. */
+void
+inode_flush (int64_t min_age)
+{
+  block_sector_t next = 0;
+
+  for (;;)
+    {
+      struct hash_iterator i;
+      struct inode *inode = NULL;
+
+      lock_acquire (&open_inodes_lock);
+      hash_first (&i, &open_inodes);
+      while (hash_next (&i))
+        {
+          struct inode *o = hash_entry (hash_cur (&i), struct inode, elem);
+          if (o->pending_cnt > 0 && o->sector >= next
+              && timer_elapsed (o->pending_since) >= min_age
+              && (inode == NULL || o->sector < inode->sector))
+            inode = o;
+        }
+      if (inode != NULL)
+        inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      if (inode == NULL)
+        break;
+      next = inode->sector + 1;
+      inode_settle_pending (inode, false);
+      inode_close (inode);
+    }
+}
+
+/* Makes inodes created from now on use FORMAT. */
+void
+inode_set_format (enum inode_format format)
+{
+  new_inode_format = format;
+}
+
+/* Returns the format INODE uses. */
+enum inode_format
+inode_get_format (const struct inode *inode)
+{
+  return uses_extents (&inode->data) ? INODE_EXTENTS : INODE_BLOCKMAP;
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+   The inode is published in open_inodes before it is read, marked
+   not ready, so that open_inodes_lock is not held across the read;
+   other openers of the same sector wait for it to become ready. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
   struct inode *inode;
+  struct inode key;
 
   lock_acquire(&open_inodes_lock);
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          lock_release(&open_inodes_lock);
-          return inode;
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release(&open_inodes_lock);
+
+      lock_acquire (&inode->inode_lock);
+      while (!inode->ready)
+        cond_wait (&inode->until_ready, &inode->inode_lock);
+      lock_release (&inode->inode_lock);
+      return inode;
     }
 
   /* Allocate memory. */
@@ -362,16 +985,28 @@ inode_open (block_sector_t sector)
     return NULL;
   }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, before other openers can find it. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->ready = false;
+  cond_init (&inode->until_ready);
+  inode->closing = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
   inode->extended = false;
-  lock_release(&open_inodes_lock);
   lock_init(&inode->inode_lock);
   cond_init(&inode->until_not_extending);
+  list_init(&inode->ranges);
+  cond_init(&inode->until_range_released);
+  inode->pending_cnt = 0;
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release(&open_inodes_lock);
+
+  bufcache_read(sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_acquire (&inode->inode_lock);
+  inode->ready = true;
+  cond_broadcast (&inode->until_ready, &inode->inode_lock);
+  lock_release (&inode->inode_lock);
   return inode;
 }
 
@@ -380,7 +1015,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -401,23 +1040,47 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener.  If the inode is
+     already being torn down, by a closer that found it reopened, that
+     closer finishes the job. */
+  lock_acquire(&open_inodes_lock);
+  if (--inode->open_cnt > 0 || inode->closing)
     {
-      /* Remove from inode list and release lock. */
-      lock_acquire(&open_inodes_lock);
-      list_remove (&inode->elem);
       lock_release(&open_inodes_lock);
-
-      /* Deallocate blocks if removed. */
-      if (inode->removed)
+      return;
+    }
+  inode->closing = true;
+
+  /* Give delayed blocks their sectors, unless they are about to be
+     freed anyway, while the inode is still in the table, so that an
+     opener in the meantime finds it rather than reading the on-disk
+     inode without them.  If it is opened again meanwhile, its new
+     last closer takes over. */
+  while (inode->pending_cnt > 0)
+    {
+      lock_release(&open_inodes_lock);
+      inode_settle_pending (inode, true);
+      lock_acquire(&open_inodes_lock);
+      if (inode->open_cnt > 0)
         {
-          free_map_release (inode->sector, 1);
-          inode_deallocate(inode);
+          inode->closing = false;
+          lock_release(&open_inodes_lock);
+          return;
         }
+    }
 
-      free (inode);
+  /* Remove from inode table and release lock. */
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release(&open_inodes_lock);
+
+  /* Deallocate blocks if removed. */
+  if (inode->removed)
+    {
+      free_map_release (inode->sector, 1);
+      inode_deallocate(inode);
     }
+
+  free (inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -429,27 +1092,149 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Initializes RA for a reader that starts at the beginning of a file. */
+void
+inode_readahead_init (struct inode_readahead *ra)
+{
+  ra->next_offset = 0;
+  ra->prefetched = 0;
+  ra->window = 0;
+}
+
+/* Updates RA for a read of SIZE bytes at OFFSET in INODE.  If the read
+   continues a sequential stream, grows the window and asks the buffer
+   cache to fetch the next sectors in the background. */
+static void
+inode_readahead (struct inode *inode, struct inode_readahead *ra,
+                 off_t offset, off_t size)
+{
+  ASSERT (lock_held_by_current_thread (&inode->inode_lock));
+  bool sequential = offset == ra->next_offset;
+  ra->next_offset = offset + size;
+  if (!sequential)
+    {
+      ra->window = 0;
+      ra->prefetched = 0;
+      return;
+    }
+  if (ra->window == 0)
+    ra->window = READAHEAD_MIN;
+  else if (ra->window < READAHEAD_MAX)
+    ra->window *= 2;
+
+  /* Prefetch the sectors past this read that are not queued yet. */
+  off_t start = ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
+  off_t end = start + ra->window * BLOCK_SECTOR_SIZE;
+  off_t length = inode_length (inode);
+  struct block_cursor cursor;
+  if (start < ra->prefetched)
+    start = ra->prefetched;
+  if (end > length)
+    end = length;
+  cursor_init (&cursor, inode);
+  for (off_t pos = start; pos < end; pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = cursor_lookup (&cursor, pos);
+      if (!(sector & SECTOR_UNWRITTEN))
+        bufcache_prefetch (sector);
+    }
+  if (end > ra->prefetched)
+    ra->prefetched = end;
+}
+
+/* Returns true if R conflicts with a range of INODE in use. */
+static bool
+range_conflicts (struct inode *inode, const struct inode_range *r)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&inode->ranges); e != list_end (&inode->ranges);
+       e = list_next (e))
+    {
+      struct inode_range *other = list_entry (e, struct inode_range, elem);
+      if ((r->write || other->write)
+          && r->start < other->end && other->start < r->end)
+        return true;
+    }
+  return false;
+}
+
+/* Waits until the SIZE bytes of INODE at OFFSET can be read, or
+   written if WRITE, alongside the other ranges in use, then claims
+   them in R.  The inode's lock must be held. */
+static void
+range_acquire (struct inode *inode, struct inode_range *r,
+               off_t offset, off_t size, bool write)
+{
+  ASSERT (lock_held_by_current_thread (&inode->inode_lock));
+  r->start = offset;
+  r->end = offset + size;
+  r->write = write;
+  while (inode->extended || range_conflicts (inode, r))
+    cond_wait (&inode->until_range_released, &inode->inode_lock);
+  list_push_back (&inode->ranges, &r->elem);
+}
+
+/* Releases range R of INODE.  The inode's lock must be held. */
+static void
+range_release (struct inode *inode, struct inode_range *r)
+{
+  ASSERT (lock_held_by_current_thread (&inode->inode_lock));
+  list_remove (&r->elem);
+  cond_broadcast (&inode->until_range_released, &inode->inode_lock);
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
+{
+  return inode_read_ahead_at (inode, buffer_, size, offset, NULL);
+}
+
+/* Like inode_read_at(), but if RA is non-null, tracks sequential access
+   in RA and reads the following sectors ahead asynchronously. */
+off_t
+inode_read_ahead_at (struct inode *inode, void *buffer_, off_t size,
+                     off_t offset, struct inode_readahead *ra)
 {
   lock_acquire(&inode->inode_lock);
 
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
+  struct block_cursor cursor;
+  struct inode_range range;
 
   /* Check whether initial offset is out of range. */
-  if (byte_to_sector(inode, offset) == (block_sector_t)-1) {
+  if (offset >= inode_length (inode)) {
     lock_release(&inode->inode_lock);
     return 0;
   }
 
+  /* Small files are read straight out of the inode. */
+  if (uses_inline (&inode->data))
+    {
+      bytes_read = inode_length (inode) - offset;
+      if (bytes_read > size)
+        bytes_read = size;
+      memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+      lock_release(&inode->inode_lock);
+      return bytes_read;
+    }
+
+  if (ra != NULL && size > 0)
+    inode_readahead (inode, ra, offset, size);
+
+  /* Other readers, and writers elsewhere in the file, go on while
+     this one waits for the disk. */
+  range_acquire (inode, &range, offset, size, false);
+
+  cursor_init (&cursor, inode);
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = cursor_lookup (&cursor, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -462,7 +1247,12 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      bufcache_read(sector_idx, (void *)(buffer + bytes_read), sector_ofs, chunk_size);
+      lock_release(&inode->inode_lock);
+      if (sector_idx & SECTOR_UNWRITTEN)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        bufcache_read(sector_idx, (void *)(buffer + bytes_read), sector_ofs, chunk_size);
+      lock_acquire(&inode->inode_lock);
 
       /* Advance. */
       size -= chunk_size;
@@ -470,11 +1260,56 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       bytes_read += chunk_size;
     }
 
+  range_release (inode, &range);
   lock_release(&inode->inode_lock);
 
   return bytes_read;
 }
 
+/* Moves the data of INODE out of the inode into a data block, mapped
+   in the format INODE was created with.  Returns false if memory or
+   disk allocation fails. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  off_t length = disk_inode->length;
+  struct block_cursor cursor;
+  block_sector_t sector;
+  uint8_t *copy = NULL;
+
+  ASSERT (list_empty (&inode->ranges));
+  if (length > 0)
+    {
+      copy = malloc (length);
+      if (copy == NULL)
+        return false;
+      memcpy (copy, disk_inode->inline_data, length);
+    }
+
+  memset (disk_inode->inline_data, 0, INLINE_DATA_SIZE);
+  disk_inode->flags &= ~INODE_INLINE;
+  if (length > 0)
+    {
+      cursor_init (&cursor, inode);
+      if (!inode_allocate (disk_inode, 0, length, inode_goal (inode, 0))
+          || (sector = cursor_materialize (&cursor, 0, false)) == (block_sector_t) -1)
+        {
+          /* Give back what was allocated and stay inline. */
+          inode_deallocate (inode);
+          memset (disk_inode->inline_data, 0, INLINE_DATA_SIZE);
+          memcpy (disk_inode->inline_data, copy, length);
+          disk_inode->flags |= INODE_INLINE;
+          free (copy);
+          return false;
+        }
+      bufcache_write (sector, copy, 0, length);
+      free (copy);
+    }
+  inode_write_disk (inode);
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -487,6 +1322,9 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   lock_acquire(&inode->inode_lock);
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
+  off_t old_length = -1;
+  struct block_cursor cursor;
+  struct inode_range range;
 
   if (inode->deny_write_cnt) {
     lock_release(&inode->inode_lock);
@@ -498,31 +1336,58 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     cond_wait(&inode->until_not_extending, &inode->inode_lock);
   }
 
-  /* File extension. */
-  if (byte_to_sector(inode, offset + size - 1) == (size_t)-1) {
-    inode->extended = true;
-    struct inode_disk *disk_inode = (struct inode_disk *)malloc(sizeof(struct inode_disk));
-    bufcache_read(inode_get_inumber(inode), disk_inode, 0, BLOCK_SECTOR_SIZE);
-
-    if (!inode_allocate(disk_inode, offset + size)) {
-      free(disk_inode);
-      inode->extended = false;
-      cond_broadcast(&inode->until_not_extending, &inode->inode_lock);
+  /* Small files are written straight into the inode, until they
+     outgrow it.  Nobody holds a range on them. */
+  if (uses_inline(&inode->data)) {
+    if (offset + size <= (off_t) INLINE_DATA_SIZE) {
+      memcpy(inode->data.inline_data + offset, buffer, size);
+      if (offset + size > inode->data.length) {
+        inode->data.length = offset + size;
+      }
+      inode_write_disk(inode);
+      lock_release(&inode->inode_lock);
+      return size;
+    }
+    if (!inode_uninline(inode)) {
       lock_release(&inode->inode_lock);
-      return bytes_written;
+      return 0;
     }
+  }
 
-    disk_inode->length = offset + size;
-    bufcache_write(inode_get_inumber(inode), (void *)disk_inode, 0, BLOCK_SECTOR_SIZE);
+  /* File extension, once nobody else is reading or writing.  Nothing
+     is allocated: the bytes between the old end and OFFSET stay a hole,
+     and the loop below allocates the blocks it writes.  A full run of
+     delayed blocks gets its sectors the same way, before a write goes
+     past it. */
+  bool extend = byte_to_sector(inode, offset + size - 1) == (size_t)-1;
+  bool flush = (inode->pending_cnt == MAX_PENDING
+                && (uint32_t) (offset + size - 1) / BLOCK_SECTOR_SIZE
+                   >= inode->pending_first + MAX_PENDING);
+  if (extend || flush) {
+    inode->extended = true;
+    while (!list_empty(&inode->ranges)) {
+      cond_wait(&inode->until_range_released, &inode->inode_lock);
+    }
+
+    if (flush) {
+      inode_flush_pending(inode);
+    }
+    if (extend) {
+      old_length = inode->data.length;
+      inode->data.length = offset + size;
+      inode_write_disk(inode);
+    }
     inode->extended = false;
     cond_broadcast(&inode->until_not_extending, &inode->inode_lock);
-    free(disk_inode);
+    cond_broadcast(&inode->until_range_released, &inode->inode_lock);
   }
 
+  range_acquire (inode, &range, offset, size, true);
+  cursor_init (&cursor, inode);
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = cursor_lookup (&cursor, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -535,7 +1400,47 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
+      /* Hold the block back from getting a sector, if we may.  It
+         is cached under a virtual sector meanwhile. */
+      if (sector_idx == SECTOR_HOLE
+          && inode_delay_block (inode, offset / BLOCK_SECTOR_SIZE))
+        {
+          sector_idx = cursor_lookup (&cursor, offset);
+          if (chunk_size < BLOCK_SECTOR_SIZE)
+            bufcache_zero (sector_idx);
+        }
+
+      /* Allocate the holes in the rest of this write at once, short
+         of delayed blocks.  Write back the pointers allocated even if
+         allocation fails part way, so that the blocks are freed with
+         the file. */
+      if (sector_idx == SECTOR_HOLE)
+        {
+          off_t alloc_size = size;
+          off_t pending_ofs = (off_t) inode->pending_first * BLOCK_SECTOR_SIZE;
+          if (inode->pending_cnt > 0 && pending_ofs > offset
+              && pending_ofs - offset < alloc_size)
+            alloc_size = pending_ofs - offset;
+          inode_allocate (&inode->data, offset, alloc_size,
+                          inode_goal (inode, offset / BLOCK_SECTOR_SIZE));
+          inode_write_disk (inode);
+          cursor_init (&cursor, inode);
+          sector_idx = cursor_lookup (&cursor, offset);
+          if (sector_idx == SECTOR_HOLE)
+            break;
+        }
+
+      /* First write to a block allocated in advance. */
+      if (sector_idx & SECTOR_UNWRITTEN)
+        {
+          sector_idx = cursor_materialize (&cursor, offset, chunk_size == BLOCK_SECTOR_SIZE);
+          if (sector_idx == (block_sector_t) -1)
+            break;
+        }
+
+      lock_release(&inode->inode_lock);
       bufcache_write(sector_idx, (void *)(buffer + bytes_written), sector_ofs, chunk_size);
+      lock_acquire(&inode->inode_lock);
 
       /* Advance. */
       size -= chunk_size;
@@ -543,10 +1448,76 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       bytes_written += chunk_size;
     }
 
+  /* Do not leave the file extended past what was written, unless
+     others may have written there since. */
+  if (old_length >= 0 && size > 0 && list_size (&inode->ranges) == 1)
+    {
+      off_t end = offset > old_length ? offset : old_length;
+      if (end < inode->data.length)
+        {
+          inode->data.length = end;
+          inode_write_disk (inode);
+        }
+    }
+
+  range_release (inode, &range);
   lock_release(&inode->inode_lock);
   return bytes_written;
 }
 
+/* Allocates the data blocks of INODE holding bytes OFFSET up to
+   OFFSET + LENGTH, in as few runs as the free map allows, and extends
+   INODE to OFFSET + LENGTH if it is shorter.  The blocks are not
+   zeroed: they are marked unwritten and read as zeros until first
+   written.  Returns false if LENGTH is not positive, as fallocate(2)
+   fails with EINVAL, or if writes are denied or the disk is full, in
+   which case INODE keeps its length and the blocks allocated. */
+bool
+inode_fallocate (struct inode *inode, off_t offset, off_t length)
+{
+  off_t end;
+  bool success;
+
+  if (offset < 0 || length <= 0 || length > INT32_MAX - offset)
+    return false;
+  end = offset + length;
+
+  lock_acquire (&inode->inode_lock);
+  if (inode->deny_write_cnt)
+    {
+      lock_release (&inode->inode_lock);
+      return false;
+    }
+
+  /* Like file extension, once nobody else is reading or writing.
+     Delayed blocks get their sectors first, so that none of the
+     range is cached under a virtual sector. */
+  while (inode->extended)
+    cond_wait (&inode->until_not_extending, &inode->inode_lock);
+  inode->extended = true;
+  while (!list_empty (&inode->ranges))
+    cond_wait (&inode->until_range_released, &inode->inode_lock);
+  if (inode->pending_cnt > 0)
+    inode_flush_pending (inode);
+
+  /* A small file has its space in the inode already. */
+  if (uses_inline (&inode->data) && end <= (off_t) INLINE_DATA_SIZE)
+    success = true;
+  else
+    success = ((!uses_inline (&inode->data) || inode_uninline (inode))
+               && inode_allocate (&inode->data, offset, length,
+                                  inode_goal (inode, offset / BLOCK_SECTOR_SIZE)));
+  if (success && end > inode->data.length)
+    inode->data.length = end;
+  inode_write_disk (inode);
+
+  inode->extended = false;
+  cond_broadcast (&inode->until_not_extending, &inode->inode_lock);
+  cond_broadcast (&inode->until_range_released, &inode->inode_lock);
+  lock_release (&inode->inode_lock);
+  return success;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -571,22 +1542,14 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  struct inode_disk *disk_inode = (struct inode_disk *)malloc(sizeof(struct inode_disk));
-  bufcache_read(inode_get_inumber(inode), disk_inode, 0, BLOCK_SECTOR_SIZE);
-  off_t length = disk_inode->length;
-  free(disk_inode);
-  return length;
+  return inode->data.length;
 }
 
 bool
 inode_isdir (const struct inode *inode)
 {
   ASSERT (inode != NULL);
-  struct inode_disk *disk_inode = (struct inode_disk *)malloc(sizeof(struct inode_disk));
-  bufcache_read(inode_get_inumber(inode), disk_inode, 0, BLOCK_SECTOR_SIZE);
-  bool isdir = disk_inode->isdir;
-  free (disk_inode);
-  return isdir;
+  return inode->data.isdir;
 }
 
 bool
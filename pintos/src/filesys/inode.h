@@ -8,6 +8,21 @@
 
 struct bitmap;
 
+/* Sequential read-ahead state, kept separately by each opener. */
+struct inode_readahead
+  {
+    off_t next_offset;          /* Where a sequential reader reads next. */
+    off_t prefetched;           /* End of the range already read ahead. */
+    size_t window;              /* Sectors to read ahead, 0 if not streaming. */
+  };
+
+/* Ways an inode can map its data blocks. */
+enum inode_format
+  {
+    INODE_BLOCKMAP,             /* Direct, indirect, doubly indirect. */
+    INODE_EXTENTS               /* Tree of extents. */
+  };
+
 void inode_init (void);
 bool inode_create (block_sector_t, off_t,bool);
 struct inode *inode_open (block_sector_t);
@@ -16,10 +31,18 @@ block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead_init (struct inode_readahead *);
+off_t inode_read_ahead_at (struct inode *, void *, off_t size, off_t offset,
+                           struct inode_readahead *);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_fallocate (struct inode *, off_t offset, off_t length);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_set_format (enum inode_format);
+void inode_set_delalloc (bool);
+void inode_flush (int64_t min_age);
+enum inode_format inode_get_format (const struct inode *);
 bool inode_isdir (const struct inode *inode);
 bool inode_is_removed (const struct inode *inode);
 #endif /* filesys/inode.h */
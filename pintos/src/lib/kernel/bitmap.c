@@ -3,6 +3,8 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,11 +25,17 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Two summary arrays, with one bit per element of BITS, let
+   searches skip ELEM_BITS elements at a time that cannot hold
+   what they are looking for. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* Bit I set if element I is all ones. */
+    elem_type *empty;   /* Bit I set if element I is all zeros. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +68,14 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required for BIT_CNT bits and
+   their summary. */
+static inline size_t
+storage_cnt (size_t bit_cnt)
+{
+  return byte_cnt (bit_cnt) + 2 * byte_cnt (elem_cnt (bit_cnt));
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -68,6 +84,102 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask in which the CNT bits starting at bit OFS of
+   an element are set to 1 and the rest are set to 0. */
+static inline elem_type
+range_mask (size_t ofs, size_t cnt)
+{
+  elem_type mask = cnt < ELEM_BITS ? ((elem_type) 1 << cnt) - 1 : (elem_type) -1;
+  return mask << ofs;
+}
+
+/* Returns the index of the lowest bit set in X, which must not be
+   0.  This is a single BSF instruction. */
+static inline size_t
+lowest_bit (elem_type x)
+{
+  return __builtin_ctzl (x);
+}
+
+/* Returns the number of bits set in X. */
+static inline size_t
+count_bits (elem_type x)
+{
+  size_t cnt = 0;
+  for (; x != 0; x &= x - 1)
+    cnt++;
+  return cnt;
+}
+
+/* Points B's bits and summary into the storage at BUF, which has
+   room for storage_cnt(B->bit_cnt) bytes, and clears them. */
+static void
+set_storage (struct bitmap *b, void *buf)
+{
+  b->bits = buf;
+  b->full = b->bits + elem_cnt (b->bit_cnt);
+  b->empty = b->full + elem_cnt (elem_cnt (b->bit_cnt));
+  memset (buf, 0, storage_cnt (b->bit_cnt));
+}
+
+/* Brings the summary bits of element IDX of B up to date with the
+   element. */
+static void
+update_summary (struct bitmap *b, size_t idx)
+{
+  elem_type valid = idx == elem_idx (b->bit_cnt - 1) ? last_mask (b) : (elem_type) -1;
+  elem_type bits = b->bits[idx] & valid;
+  elem_type mask = bit_mask (idx);
+
+  if (bits == valid)
+    b->full[elem_idx (idx)] |= mask;
+  else
+    b->full[elem_idx (idx)] &= ~mask;
+  if (bits == 0)
+    b->empty[elem_idx (idx)] |= mask;
+  else
+    b->empty[elem_idx (idx)] &= ~mask;
+}
+
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.  Looks
+   at an element at a time, and skips the elements the summary shows
+   to have no bit set to VALUE. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  const elem_type *skip = value ? b->empty : b->full;
+  size_t i = start;
+
+  while (i < end)
+    {
+      size_t idx = elem_idx (i);
+      elem_type x = value ? b->bits[idx] : ~b->bits[idx];
+
+      x &= (elem_type) -1 << (i % ELEM_BITS);
+      if (x != 0)
+        {
+          i = idx * ELEM_BITS + lowest_bit (x);
+          return i < end ? i : end;
+        }
+
+      /* Skip the elements that follow, up to the first one that may
+         hold a bit set to VALUE, within one summary element. */
+      idx++;
+      i = idx * ELEM_BITS;
+      if (i < end)
+        {
+          elem_type candidates = ~(skip[elem_idx (idx)] >> (idx % ELEM_BITS));
+          if (candidates == 0)
+            idx += ELEM_BITS;
+          else
+            idx += lowest_bit (candidates);
+          i = idx * ELEM_BITS;
+        }
+    }
+  return end;
+}
 
 /* Creation and destruction. */
 
@@ -81,10 +193,11 @@ bitmap_create (size_t bit_cnt)
   struct bitmap *b = malloc (sizeof *b);
   if (b != NULL)
     {
+      void *buf = malloc (storage_cnt (bit_cnt));
       b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
-      if (b->bits != NULL || bit_cnt == 0)
+      if (buf != NULL || bit_cnt == 0)
         {
+          set_storage (b, buf);
           bitmap_set_all (b, false);
           return b;
         }
@@ -104,7 +217,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
-  b->bits = (elem_type *) (b + 1);
+  set_storage (b, b + 1);
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +227,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt)
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + storage_cnt (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -159,10 +272,12 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  /* Interrupts are off so that the element and its summary
+     change atomically on a uniprocessor machine. */
+  enum intr_level old_level = intr_disable ();
+  b->bits[idx] |= mask;
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -172,10 +287,10 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  enum intr_level old_level = intr_disable ();
+  b->bits[idx] &= ~mask;
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -187,10 +302,10 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] ^= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the XOR instruction in [IA32-v2b]. */
-  asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  enum intr_level old_level = intr_disable ();
+  b->bits[idx] ^= mask;
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +328,33 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is set atomically, but not the whole range. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
-
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t ofs = start % ELEM_BITS;
+      size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+      elem_type mask = range_mask (ofs, n);
+      enum intr_level old_level = intr_disable ();
+
+      if (value)
+        b->bits[idx] |= mask;
+      else
+        b->bits[idx] &= ~mask;
+      update_summary (b, idx);
+      intr_set_level (old_level);
+
+      start += n;
+      cnt -= n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,16 +362,24 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i, value_cnt;
+  size_t value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t ofs = start % ELEM_BITS;
+      size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+      elem_type x = value ? b->bits[idx] : ~b->bits[idx];
+
+      value_cnt += count_bits (x & range_mask (ofs, n));
+      start += n;
+      cnt -= n;
+    }
   return value_cnt;
 }
 
@@ -250,16 +388,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
-
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,13 +431,42 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt)
+  return bitmap_scan_range (b, start, b->bit_cnt, cnt, value);
+}
+
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B between START and END, exclusive, that are
+   all set to VALUE.
+   If there is no such group, returns BITMAP_ERROR.
+   Each candidate group starts at the next bit set to VALUE, and
+   ends early at the first bit that is not, so the search takes
+   time in proportion to the elements it looks at, not the bits. */
+size_t
+bitmap_scan_range (const struct bitmap *b, size_t start, size_t end,
+                   size_t cnt, bool value)
+{
+  ASSERT (b != NULL);
+  ASSERT (start <= end);
+  ASSERT (end <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+  if (cnt <= end - start)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i;
+      size_t last = end - cnt;
+      size_t i = start;
+      while (i <= last)
+        {
+          size_t stop;
+
+          i = find_bit (b, i, last + 1, value);
+          if (i > last)
+            break;
+          stop = find_bit (b, i, i + cnt, !value);
+          if (stop == i + cnt)
+            return i;
+          i = stop + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -344,8 +506,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0)
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t idx;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (idx = 0; idx < elem_cnt (b->bit_cnt); idx++)
+        update_summary (b, idx);
     }
   return success;
 }
@@ -358,6 +524,26 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds bits START up to START + CNT to
+   FILE, where bitmap_write() would put it.  Whole elements are
+   written, so bits next to the range may be written too.  Return
+   true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  ofs = elem_idx (start) * sizeof (elem_type);
+  size = (elem_idx (start + cnt - 1) + 1) * sizeof (elem_type) - ofs;
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -30,6 +30,7 @@ enum
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
     SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_FALLOCATE,              /* Allocates space for a file. */
 
     SYS_HIT_COUNT,              /* Get number of hits. */
     SYS_ACCESS_COUNT,           /* Get number of accesses. */
@@ -0,0 +1,6 @@
+/* Checks that a buffer cache using the 2Q replacement policy
+   keeps a hot set of sectors through a scan much larger than the
+   cache. */
+
+#define SCAN_RESISTANT true
+#include "tests/filesys/extended/cache-policy.inc"
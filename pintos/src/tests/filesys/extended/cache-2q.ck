@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-2q) begin
+(cache-2q) create "scan"
+(cache-2q) open "scan"
+(cache-2q) write "scan"
+(cache-2q) create "filler"
+(cache-2q) open "filler"
+(cache-2q) write "filler"
+(cache-2q) create "hot"
+(cache-2q) open "hot"
+(cache-2q) write "hot"
+(cache-2q) read "hot" among "filler"
+(cache-2q) read "scan"
+(cache-2q) read "hot"
+(cache-2q) "hot" survived the scan
+(cache-2q) end
+EOF
+pass;
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-arc) begin
+(cache-arc) create "scan"
+(cache-arc) open "scan"
+(cache-arc) write "scan"
+(cache-arc) create "filler"
+(cache-arc) open "filler"
+(cache-arc) write "filler"
+(cache-arc) create "hot"
+(cache-arc) open "hot"
+(cache-arc) write "hot"
+(cache-arc) read "hot" among "filler"
+(cache-arc) read "scan"
+(cache-arc) read "hot"
+(cache-arc) "hot" survived the scan
+(cache-arc) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+/* Checks that a buffer cache using the CLOCK replacement policy
+   lets a scan much larger than the cache flush out a hot set of
+   sectors, as 2Q and ARC do not. */
+
+#define SCAN_RESISTANT false
+#include "tests/filesys/extended/cache-policy.inc"
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-clock) begin
+(cache-clock) create "scan"
+(cache-clock) open "scan"
+(cache-clock) write "scan"
+(cache-clock) create "filler"
+(cache-clock) open "filler"
+(cache-clock) write "filler"
+(cache-clock) create "hot"
+(cache-clock) open "hot"
+(cache-clock) write "hot"
+(cache-clock) read "hot" among "filler"
+(cache-clock) read "scan"
+(cache-clock) read "hot"
+(cache-clock) "hot" was flushed by the scan
+(cache-clock) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"scan" => ["s" x 262144],
+		"filler" => ["f" x 131072],
+		"hot" => ["h" x 4096]});
+pass;
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-lru) begin
+(cache-lru) create "scan"
+(cache-lru) open "scan"
+(cache-lru) write "scan"
+(cache-lru) create "filler"
+(cache-lru) open "filler"
+(cache-lru) write "filler"
+(cache-lru) create "hot"
+(cache-lru) open "hot"
+(cache-lru) write "hot"
+(cache-lru) read "hot" among "filler"
+(cache-lru) read "scan"
+(cache-lru) read "hot"
+(cache-lru) "hot" was flushed by the scan
+(cache-lru) end
+EOF
+pass;
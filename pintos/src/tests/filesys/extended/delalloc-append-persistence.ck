@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"log" => [join ('', map (chr ($_ % 251), 0...50999))]});
+pass;
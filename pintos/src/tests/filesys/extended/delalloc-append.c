@@ -0,0 +1,48 @@
+/* Appends to a file with delayed allocation, reads the appended
+   data back before it has sectors, and checks it after closing and
+   reopening the file.  Then appends more to the reopened file. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FIRST_SIZE 50000
+#define CHUNK 1000
+
+static char buf[FIRST_SIZE + CHUNK];
+static char back[FIRST_SIZE];
+
+void
+test_main (void)
+{
+  const char *file_name = "log";
+  size_t ofs;
+  int fd;
+
+  for (ofs = 0; ofs < sizeof buf; ofs++)
+    buf[ofs] = ofs % 251;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("append to \"%s\"", file_name);
+  for (ofs = 0; ofs < FIRST_SIZE; ofs += CHUNK)
+    if (write (fd, buf + ofs, CHUNK) != CHUNK)
+      fail ("write %d bytes at offset %zu in \"%s\" failed",
+            CHUNK, ofs, file_name);
+
+  seek (fd, 0);
+  CHECK (read (fd, back, FIRST_SIZE) == FIRST_SIZE,
+         "read back \"%s\"", file_name);
+  compare_bytes (back, buf, FIRST_SIZE, 0, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, FIRST_SIZE);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  seek (fd, FIRST_SIZE);
+  CHECK (write (fd, buf + FIRST_SIZE, CHUNK) == CHUNK,
+         "append to \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(delalloc-append) begin
+(delalloc-append) create "log"
+(delalloc-append) open "log"
+(delalloc-append) append to "log"
+(delalloc-append) read back "log"
+(delalloc-append) close "log"
+(delalloc-append) open "log" for verification
+(delalloc-append) verified contents of "log"
+(delalloc-append) close "log"
+(delalloc-append) open "log"
+(delalloc-append) append to "log"
+(delalloc-append) close "log"
+(delalloc-append) open "log" for verification
+(delalloc-append) verified contents of "log"
+(delalloc-append) close "log"
+(delalloc-append) end
+EOF
+pass;
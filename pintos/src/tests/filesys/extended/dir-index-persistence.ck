@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+$fs->{'big'}{"f$_"} = [''] foreach 0...59;
+check_archive ($fs);
+pass;
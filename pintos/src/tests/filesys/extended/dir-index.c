@@ -0,0 +1,93 @@
+/* Creates enough files in a directory for it to be indexed,
+   removes every other one and checks that lookups find exactly the
+   rest, then creates the removed files again and checks that
+   readdir lists each file once. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 60
+
+static void
+file_name (char name[], int i)
+{
+  snprintf (name, 16, "big/f%d", i);
+}
+
+/* Checks that file I can be opened if EXISTS, and cannot otherwise. */
+static void
+check_open (int i, bool exists)
+{
+  char name[16];
+  int fd;
+
+  file_name (name, i);
+  fd = open (name);
+  if (exists && fd < 2)
+    fail ("open \"%s\" failed", name);
+  if (!exists && fd >= 2)
+    fail ("opened \"%s\", which was removed", name);
+  if (fd >= 2)
+    close (fd);
+}
+
+void
+test_main (void)
+{
+  char name[16];
+  bool seen[FILE_CNT];
+  int fd, cnt, i;
+
+  CHECK (mkdir ("big"), "mkdir \"big\"");
+  msg ("create %d files in \"big\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  msg ("open each file");
+  for (i = 0; i < FILE_CNT; i++)
+    check_open (i, true);
+
+  msg ("remove every other file");
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      file_name (name, i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  msg ("open each file");
+  for (i = 0; i < FILE_CNT; i++)
+    check_open (i, i % 2 != 0);
+
+  msg ("create the removed files again");
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      file_name (name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  msg ("open each file");
+  for (i = 0; i < FILE_CNT; i++)
+    check_open (i, true);
+
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  memset (seen, 0, sizeof seen);
+  cnt = 0;
+  while (readdir (fd, name))
+    {
+      if (name[0] != 'f' || (i = atoi (name + 1)) < 0 || i >= FILE_CNT
+          || seen[i])
+        fail ("readdir returned unexpected \"%s\"", name);
+      seen[i] = true;
+      cnt++;
+    }
+  CHECK (cnt == FILE_CNT, "readdir \"big\" lists %d files", FILE_CNT);
+  msg ("close \"big\"");
+  close (fd);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-index) begin
+(dir-index) mkdir "big"
+(dir-index) create 60 files in "big"
+(dir-index) open each file
+(dir-index) remove every other file
+(dir-index) open each file
+(dir-index) create the removed files again
+(dir-index) open each file
+(dir-index) open "big"
+(dir-index) readdir "big" lists 60 files
+(dir-index) close "big"
+(dir-index) end
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Looks up names in a directory before and after they are created
+   and removed, and after the directory itself is removed and made
+   again, checking that no earlier lookup is remembered wrongly. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Checks that NAME can be opened if EXISTS, and cannot otherwise. */
+static void
+check_open (const char *name, bool exists)
+{
+  int fd = open (name);
+
+  if (exists)
+    {
+      CHECK (fd > 1, "open \"%s\"", name);
+      close (fd);
+    }
+  else
+    CHECK (fd < 0, "open \"%s\" fails", name);
+}
+
+void
+test_main (void)
+{
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/x", 0), "create \"a/x\"");
+  check_open ("a/x", true);
+  check_open ("a/y", false);
+
+  CHECK (remove ("a/x"), "remove \"a/x\"");
+  check_open ("a/x", false);
+  CHECK (create ("a/y", 0), "create \"a/y\"");
+  check_open ("a/y", true);
+
+  CHECK (remove ("a/y"), "remove \"a/y\"");
+  CHECK (remove ("a"), "remove \"a\"");
+  check_open ("a/y", false);
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  check_open ("a/x", false);
+  check_open ("a/y", false);
+  CHECK (create ("a/x", 0), "create \"a/x\"");
+  check_open ("a/x", true);
+}
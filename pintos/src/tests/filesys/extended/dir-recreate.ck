@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-recreate) begin
+(dir-recreate) mkdir "a"
+(dir-recreate) create "a/x"
+(dir-recreate) open "a/x"
+(dir-recreate) open "a/y" fails
+(dir-recreate) remove "a/x"
+(dir-recreate) open "a/x" fails
+(dir-recreate) create "a/y"
+(dir-recreate) open "a/y"
+(dir-recreate) remove "a/y"
+(dir-recreate) remove "a"
+(dir-recreate) open "a/y" fails
+(dir-recreate) mkdir "a"
+(dir-recreate) open "a/x" fails
+(dir-recreate) open "a/y" fails
+(dir-recreate) create "a/x"
+(dir-recreate) open "a/x"
+(dir-recreate) end
+EOF
+pass;
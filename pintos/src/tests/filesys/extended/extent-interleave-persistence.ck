@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+sub blocks {
+    my ($file) = @_;
+    return join ('', map (chr ((int ($_ / 512) * 2 + $file) % 256), 0...40959));
+}
+check_archive ({"a" => [blocks (0)], "b" => [blocks (1)]});
+pass;
@@ -0,0 +1,44 @@
+/* Writes two files a block at a time, alternating between them, on
+   a file system whose inodes map their blocks with extents, so that
+   each file is split into many short extents.  Then checks both. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 40960
+#define BLOCK_SIZE 512
+
+static char buf[2][FILE_SIZE];
+
+void
+test_main (void)
+{
+  const char *file_names[2] = {"a", "b"};
+  int fd[2];
+  size_t i, ofs;
+
+  for (i = 0; i < 2; i++)
+    {
+      for (ofs = 0; ofs < FILE_SIZE; ofs++)
+        buf[i][ofs] = ofs / BLOCK_SIZE * 2 + i;
+      CHECK (create (file_names[i], 0), "create \"%s\"", file_names[i]);
+      CHECK ((fd[i] = open (file_names[i])) > 1,
+             "open \"%s\"", file_names[i]);
+    }
+
+  msg ("write \"a\" and \"b\" alternately");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    for (i = 0; i < 2; i++)
+      if (write (fd[i], buf[i] + ofs, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write %d bytes at offset %zu in \"%s\" failed",
+              BLOCK_SIZE, ofs, file_names[i]);
+
+  for (i = 0; i < 2; i++)
+    {
+      msg ("close \"%s\"", file_names[i]);
+      close (fd[i]);
+    }
+  for (i = 0; i < 2; i++)
+    check_file (file_names[i], buf[i], FILE_SIZE);
+}
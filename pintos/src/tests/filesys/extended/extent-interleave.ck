@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(extent-interleave) begin
+(extent-interleave) create "a"
+(extent-interleave) open "a"
+(extent-interleave) create "b"
+(extent-interleave) open "b"
+(extent-interleave) write "a" and "b" alternately
+(extent-interleave) close "a"
+(extent-interleave) close "b"
+(extent-interleave) open "a" for verification
+(extent-interleave) verified contents of "a"
+(extent-interleave) close "a"
+(extent-interleave) open "b" for verification
+(extent-interleave) verified contents of "b"
+(extent-interleave) close "b"
+(extent-interleave) end
+EOF
+pass;
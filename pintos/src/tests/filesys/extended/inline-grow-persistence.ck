@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+sub letters {
+    my ($cnt) = @_;
+    return join ('', map (chr (ord ('a') + $_ % 26), 0...$cnt - 1));
+}
+check_archive ({"grown" => [letters (3000)],
+                "zeros" => ["\0" x 450 . letters (100)]});
+pass;
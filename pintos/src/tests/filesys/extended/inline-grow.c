@@ -0,0 +1,44 @@
+/* Grows a small file, whose data is kept in its inode, up to the
+   500 bytes that fit there and then past them, and a file created
+   with 400 bytes by a write that crosses the limit.  Checks both. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[3000];
+static char zeros[550];
+
+void
+test_main (void)
+{
+  size_t i;
+  int fd;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = 'a' + i % 26;
+
+  CHECK (create ("grown", 0), "create \"grown\"");
+  CHECK ((fd = open ("grown")) > 1, "open \"grown\"");
+  CHECK (write (fd, buf, 300) == 300, "write 300 bytes to \"grown\"");
+  CHECK (write (fd, buf + 300, 200) == 200, "write 200 bytes to \"grown\"");
+  CHECK (filesize (fd) == 500, "filesize \"grown\"");
+  CHECK (write (fd, buf + 500, 1) == 1, "write 1 byte to \"grown\"");
+  CHECK (write (fd, buf + 501, sizeof buf - 501) == sizeof buf - 501,
+         "write %zu bytes to \"grown\"", sizeof buf - 501);
+  CHECK (filesize (fd) == sizeof buf, "filesize \"grown\"");
+  msg ("close \"grown\"");
+  close (fd);
+  check_file ("grown", buf, sizeof buf);
+
+  CHECK (create ("zeros", 400), "create \"zeros\"");
+  CHECK ((fd = open ("zeros")) > 1, "open \"zeros\"");
+  seek (fd, 450);
+  CHECK (write (fd, buf, 100) == 100, "write 100 bytes to \"zeros\"");
+  CHECK (filesize (fd) == sizeof zeros, "filesize \"zeros\"");
+  msg ("close \"zeros\"");
+  close (fd);
+  for (i = 0; i < 100; i++)
+    zeros[450 + i] = buf[i];
+  check_file ("zeros", zeros, sizeof zeros);
+}
@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(inline-grow) begin
+(inline-grow) create "grown"
+(inline-grow) open "grown"
+(inline-grow) write 300 bytes to "grown"
+(inline-grow) write 200 bytes to "grown"
+(inline-grow) filesize "grown"
+(inline-grow) write 1 byte to "grown"
+(inline-grow) write 2499 bytes to "grown"
+(inline-grow) filesize "grown"
+(inline-grow) close "grown"
+(inline-grow) open "grown" for verification
+(inline-grow) verified contents of "grown"
+(inline-grow) close "grown"
+(inline-grow) create "zeros"
+(inline-grow) open "zeros"
+(inline-grow) write 100 bytes to "zeros"
+(inline-grow) filesize "zeros"
+(inline-grow) close "zeros"
+(inline-grow) open "zeros" for verification
+(inline-grow) verified contents of "zeros"
+(inline-grow) close "zeros"
+(inline-grow) end
+EOF
+pass;
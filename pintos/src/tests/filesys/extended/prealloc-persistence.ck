@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"prealloc" => ["\0" x 5000 . "a" x 1000 . "\0" x 14000]});
+pass;
@@ -0,0 +1,27 @@
+/* Checks that preallocating zero bytes fails, as fallocate(2)
+   does, and leaves the file as it was, even past its end. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[100];
+
+void
+test_main (void)
+{
+  const char *file_name = "prealloc-zero";
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write \"%s\"", file_name);
+  CHECK (!fallocate (fd, 0, 0), "fallocate \"%s\" at 0 must fail", file_name);
+  CHECK (!fallocate (fd, 5000, 0),
+         "fallocate \"%s\" past end must fail", file_name);
+  CHECK (filesize (fd) == sizeof buf, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
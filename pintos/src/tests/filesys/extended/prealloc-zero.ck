@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(prealloc-zero) begin
+(prealloc-zero) create "prealloc-zero"
+(prealloc-zero) open "prealloc-zero"
+(prealloc-zero) write "prealloc-zero"
+(prealloc-zero) fallocate "prealloc-zero" at 0 must fail
+(prealloc-zero) fallocate "prealloc-zero" past end must fail
+(prealloc-zero) filesize "prealloc-zero"
+(prealloc-zero) close "prealloc-zero"
+(prealloc-zero) open "prealloc-zero" for verification
+(prealloc-zero) verified contents of "prealloc-zero"
+(prealloc-zero) close "prealloc-zero"
+(prealloc-zero) end
+EOF
+pass;
@@ -0,0 +1,32 @@
+/* Preallocates a file, checks that it reads as zeros at its new
+   size, then overwrites part of it and checks that the rest still
+   reads as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[20000];
+
+void
+test_main (void)
+{
+  const char *file_name = "prealloc";
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (fallocate (fd, 0, sizeof buf), "fallocate \"%s\"", file_name);
+  CHECK (filesize (fd) == sizeof buf, "filesize \"%s\"", file_name);
+  CHECK (tell (fd) == 0, "tell \"%s\"", file_name);
+  check_file_handle (fd, file_name, buf, sizeof buf);
+
+  memset (buf + 5000, 'a', 1000);
+  seek (fd, 5000);
+  CHECK (write (fd, buf + 5000, 1000) == 1000, "write \"%s\"", file_name);
+  CHECK (filesize (fd) == sizeof buf, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
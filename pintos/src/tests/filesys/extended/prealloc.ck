@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(prealloc) begin
+(prealloc) create "prealloc"
+(prealloc) open "prealloc"
+(prealloc) fallocate "prealloc"
+(prealloc) filesize "prealloc"
+(prealloc) tell "prealloc"
+(prealloc) verified contents of "prealloc"
+(prealloc) write "prealloc"
+(prealloc) filesize "prealloc"
+(prealloc) close "prealloc"
+(prealloc) open "prealloc" for verification
+(prealloc) verified contents of "prealloc"
+(prealloc) close "prealloc"
+(prealloc) end
+EOF
+pass;
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"sparse" => ["a" x 512 . "\0" x 74488 . "m" x 1000
+                             . "\0" x 73488 . "z" x 512]});
+pass;
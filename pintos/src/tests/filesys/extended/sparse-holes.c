@@ -0,0 +1,48 @@
+/* Writes a block at each end of a file, leaving a hole between
+   them, and checks the file's size and that the hole reads as
+   zeros.  Then writes into the middle of the hole and checks the
+   whole file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 150000
+
+static char buf[FILE_SIZE];
+static char hole[4096];
+
+void
+test_main (void)
+{
+  const char *file_name = "sparse";
+  size_t i;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  memset (buf, 'a', 512);
+  CHECK (write (fd, buf, 512) == 512, "write start of \"%s\"", file_name);
+  memset (buf + FILE_SIZE - 512, 'z', 512);
+  seek (fd, FILE_SIZE - 512);
+  CHECK (write (fd, buf + FILE_SIZE - 512, 512) == 512,
+         "write end of \"%s\"", file_name);
+  CHECK (filesize (fd) == FILE_SIZE, "filesize \"%s\"", file_name);
+
+  seek (fd, 70000);
+  CHECK (read (fd, hole, sizeof hole) == sizeof hole,
+         "read hole in \"%s\"", file_name);
+  for (i = 0; i < sizeof hole; i++)
+    if (hole[i] != 0)
+      fail ("byte %zu of the hole is %d, not 0", 70000 + i, hole[i]);
+
+  memset (buf + 75000, 'm', 1000);
+  seek (fd, 75000);
+  CHECK (write (fd, buf + 75000, 1000) == 1000,
+         "write into hole in \"%s\"", file_name);
+  CHECK (filesize (fd) == FILE_SIZE, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sparse-holes) begin
+(sparse-holes) create "sparse"
+(sparse-holes) open "sparse"
+(sparse-holes) write start of "sparse"
+(sparse-holes) write end of "sparse"
+(sparse-holes) filesize "sparse"
+(sparse-holes) read hole in "sparse"
+(sparse-holes) write into hole in "sparse"
+(sparse-holes) filesize "sparse"
+(sparse-holes) close "sparse"
+(sparse-holes) open "sparse" for verification
+(sparse-holes) verified contents of "sparse"
+(sparse-holes) close "sparse"
+(sparse-holes) end
+EOF
+pass;
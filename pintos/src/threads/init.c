@@ -34,6 +34,8 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/bufcache.h"
+#include "filesys/inode.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -247,6 +249,28 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        {
+          if (value == NULL || atoi (value) <= 0)
+            PANIC ("bad cache size `%s' (use -h for help)", value);
+          bufcache_set_size (atoi (value));
+        }
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (value == NULL || !bufcache_select_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-delalloc"))
+        inode_set_delalloc (true);
+      else if (!strcmp (name, "-inode-format"))
+        {
+          if (value != NULL && !strcmp (value, "blockmap"))
+            inode_set_format (INODE_BLOCKMAP);
+          else if (value != NULL && !strcmp (value, "extent"))
+            inode_set_format (INODE_EXTENTS);
+          else
+            PANIC ("unknown inode format `%s' (use -h for help)", value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -373,6 +397,12 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=N           Start with a buffer cache of N sectors.\n"
+          "  -cache-policy=NAME Use buffer cache replacement policy NAME\n"
+          "                     (lru, clock, 2q or arc; default lru).\n"
+          "  -inode-format=FMT  With -f, map file blocks with FMT\n"
+          "                     (blockmap or extent; default blockmap).\n"
+          "  -delalloc          Allocate appended blocks on flush, in runs.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
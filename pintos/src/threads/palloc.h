@@ -15,6 +15,8 @@ void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
+size_t palloc_free_count (enum palloc_flags);
+size_t palloc_pool_size (enum palloc_flags);
 void palloc_free_multiple (void *, size_t page_cnt);
 
 #endif /* threads/palloc.h */
@@ -119,6 +119,14 @@ struct thread
     /* Current working directory of the thread. */
     struct dir* cwd;
 
+    /* Sector after the last run the thread allocated, or 0.  Owned by
+       filesys/free-map.c. */
+    block_sector_t alloc_hint;
+
+    /* Reserved free map sectors the thread's allocations may use.
+       Owned by filesys/free-map.c. */
+    size_t alloc_reserved;
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
@@ -54,6 +54,7 @@ static void syscall_mkdir (struct intr_frame *f);
 static void syscall_readdir (struct intr_frame *f);
 static void syscall_isdir (struct intr_frame *f); 
 static void syscall_inumber (struct intr_frame *f); 
+static void syscall_fallocate (struct intr_frame *f);
 
 /* Syscall for tests. */
 static void syscall_hit_count (struct intr_frame *f);
@@ -88,6 +89,7 @@ syscall_init (void)
   syscalls[SYS_READDIR]  = syscall_readdir;
   syscalls[SYS_ISDIR]    = syscall_isdir;
   syscalls[SYS_INUMBER]  = syscall_inumber;
+  syscalls[SYS_FALLOCATE] = syscall_fallocate;
 
   syscalls[SYS_HIT_COUNT]  = syscall_hit_count;
   syscalls[SYS_ACCESS_COUNT] = syscall_access_count;
@@ -424,6 +426,27 @@ syscall_inumber (struct intr_frame *f)
     f->eax = -1;
 }
 
+static void
+syscall_fallocate (struct intr_frame *f)
+{
+  uint32_t *args = (uint32_t *) f->esp;
+  if (!validate (args, 3))
+    exception_exit(-1);
+
+  int fd = args[1];
+  off_t offset = args[2];
+  off_t length = args[3];
+  struct file_descriptor *found = find_fd (fd);
+  if (!found)
+    exception_exit(-1);
+
+  struct inode *inode = file_get_inode (found->curr_file);
+  if (inode_isdir (inode))
+    f->eax = false;
+  else
+    f->eax = file_allocate (found->curr_file, offset, length);
+}
+
 /* Check whether the pointer address is valid for not. */
 bool validate (uint32_t *args, int num)
 {